@@ -7,6 +7,7 @@ public:
 	Camera() = delete;
 	Camera(const cv::FileNode& node, Checkerboard);
 	/*
+	   Searches the images in parallel, corners of images searched in an earlier run are taken from the cache
 	   @param The path to image folder
 	*/
 	void Calibrate(Checkerboard const&, std::string path);
@@ -35,5 +36,15 @@ public:
 
 private:
 	cv::Mat mIntrinsic, mDistCoeffs, mR, mRvec, mT, mExtrinsic;
+	std::string mCornerCacheFile = "corner_cache.xml";	// Corners of the calibration images searched so far, in the settings folder
+	std::string mRejection = "per_view";	// How views are rejected before the final calibration, "per_view" or "leave_one_out"
+	double mMaxViewErrorFactor = 2.0;		// Per-view error, relative to the median, above which a view is rejected
 	void Save(std::string fileName);
+
+	/*
+		@param The points of every view, the rejected views are removed
+		@param The size of the images
+	*/
+	void RejectByViewError(std::vector<std::vector<cv::Point3f>>& objPoints, std::vector<std::vector<cv::Point2f>>& imgPoints, cv::Size imageSize);
+	void RejectLeaveOneOut(std::vector<std::vector<cv::Point3f>>& objPoints, std::vector<std::vector<cv::Point2f>>& imgPoints, cv::Size imageSize);
 };
\ No newline at end of file
@@ -9,11 +9,24 @@ public:
 	int GetWidth() const { return mWidth; }
 	int GetHeight() const { return mHeight; }
 	float GetCm() const { return mCm; }
+	int GetPyramidWidth() const { return mPyramidWidth; }
+
+	/*
+		@return The world coordinates of the inner corners, in the order FindPoints returns them
+	*/
+	std::vector<cv::Point3f> ObjectPoints() const;
 
 	int FindPoints(cv::Mat& frame, std::vector<cv::Point3f>& objPoints, std::vector<cv::Point2f>& imgPoints, bool drawCorners = false) const;
 
 private:
+	/*
+		Searches the smallest pyramid level that is at least mPyramidWidth pixels wide,
+		the corners found there are scaled back to full resolution
+	*/
+	bool FindCornersPyramid(const cv::Mat& gray, std::vector<cv::Point2f>& imgPoints) const;
+
 	int mWidth;
 	int mHeight;
 	float mCm;	
+	int mPyramidWidth = 0;	// 0 searches at full resolution
 };
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+class Checkerboard;
+
+/*
+	The checkerboard corners found on an image
+*/
+struct CachedCorners
+{
+	bool found = false;
+	cv::Size imageSize;
+	std::vector<cv::Point2f> corners;
+};
+
+/*
+	Corners of every calibration image searched so far, kept in a file between runs.
+	An image is keyed by its path, file size and modification time, so a changed file is searched again.
+	Another checkerboard, or other search settings, invalidate the whole cache.
+*/
+class CornerCache
+{
+public:
+	void Load(const std::string& path, Checkerboard const&);
+	void Save(const std::string& path, Checkerboard const&) const;
+
+	/*
+		@return True if the image is cached and the file did not change since
+	*/
+	bool Find(const std::string& image, CachedCorners& corners) const;
+	void Store(const std::string& image, const CachedCorners& corners);
+
+private:
+	struct Entry
+	{
+		std::string key;
+		CachedCorners corners;
+	};
+
+	/*
+		@return "<file size>:<modification time>", empty if the file can't be read
+	*/
+	static std::string Key(const std::string& image);
+
+	std::map<std::string, Entry> mEntries;
+};
@@ -7,6 +7,8 @@
 #include <limits.h>
 #include <algorithm>
 #include <random>
+#include <map>
+#include <filesystem>
 
 // OpenCV headers
 #include <opencv2/opencv.hpp>
@@ -1,11 +1,18 @@
 #include "cvpch.h"
 #include "checkerboard.h"
 #include "camera.h"
+#include "corner_cache.h"
 
 Camera::Camera(const cv::FileNode& node, Checkerboard checkerboard)
 {
 	std::string dataLoc;
 	node["Calibration_Output_File_Name"] >> dataLoc;
+	if (!node["Corner_Cache_File_Name"].empty())
+		node["Corner_Cache_File_Name"] >> mCornerCacheFile;
+	if (!node["Calibration_Rejection"].empty())
+		node["Calibration_Rejection"] >> mRejection;
+	if (!node["Calibration_Max_View_Error_Factor"].empty())
+		node["Calibration_Max_View_Error_Factor"] >> mMaxViewErrorFactor;
 
 	cv::FileStorage calibData(util::SETTINGS_DIR_STR + dataLoc, cv::FileStorage::READ); // Read the settings
 	if (calibData.isOpened())
@@ -51,93 +58,160 @@ void Camera::Calibrate(Checkerboard const& checkerboard, std::string path)
 	auto rng = std::default_random_engine{ rd() };
 	std::shuffle(images.begin(), images.end(), rng);
 
-	cv::Mat frame;
+	CornerCache cache;
+	cache.Load(util::SETTINGS_DIR_STR + mCornerCacheFile, checkerboard);
 
-	// Looping over all the images in the directory
+	std::vector<CachedCorners> results(images.size());
+	std::vector<char> cached(images.size());
+	for (size_t i = 0; i < images.size(); i++)
+		cached[i] = cache.Find(images[i], results[i]);
+
+	// Decode and search the images on all cores, images whose corners are cached are not read at all
+	int64 start = cv::getTickCount();
+	cv::parallel_for_(cv::Range(0, (int)images.size()), [&](const cv::Range& range)
+	{
+		for (int i = range.start; i < range.end; i++)
+		{
+			if (cached[i]) continue;
+			cv::Mat frame = cv::imread(images[i]);
+			std::vector<cv::Point3f> objp;
+			CachedCorners& result = results[i];
+			result.imageSize = frame.size();
+			// Find the image points of the checkerboard corners / intersections
+			result.found = !frame.empty() && checkerboard.FindPoints(frame, objp, result.corners);
+		}
+	});
+	double ms = 1000.0 * (cv::getTickCount() - start) / cv::getTickFrequency();
+	size_t hits = std::count(cached.begin(), cached.end(), 1);
+	printf("Loaded %zu images in %.1f ms, %zu corners from the cache\n", images.size(), ms, hits);
+
+	cv::Size frameSize;
+	const std::vector<cv::Point3f> boardPoints = checkerboard.ObjectPoints();
 	for (int i = 0; i < images.size(); i++)
 	{
-		frame = cv::imread(images[i]);
-		std::vector<cv::Point3f> objp;
-		std::vector<cv::Point2f> imgp;
-		// Find the image points of the checkerboard corners / intersections
-		if (checkerboard.FindPoints(frame, objp, imgp, true))
+		const CachedCorners& result = results[i];
+		if (!cached[i])
+			cache.Store(images[i], result);
+
+		if (result.found)
 		{
 			// Add the pattern to our correct frames, aka frames where we recognize a checkerboard
-			objPoints.push_back(objp);
-			imgPoints.push_back(imgp);
-
-			auto size = cv::Size(frame.rows, frame.cols);
-#ifdef _DEBUG
-			cv::imshow("Image", frame);
-			cv::waitKey(1);
-#endif
+			objPoints.push_back(boardPoints);
+			imgPoints.push_back(result.corners);
 			printf("Found checkerboard on image %d\n", i);
 		}
 		else
 		{
 			printf("Did not find checkerboard on image %d\n", i);
 		}
+		if (result.imageSize.area() > 0)
+			frameSize = result.imageSize;
 	}
-
-	cv::destroyAllWindows();
+	if (hits < images.size())
+		cache.Save(util::SETTINGS_DIR_STR + mCornerCacheFile, checkerboard);
 
 	// CALIBRATION
 	// We calibrate our camera using our known 3D points and respective image points
-	double currError = cv::calibrateCamera(objPoints, imgPoints, cv::Size(frame.rows, frame.cols), mIntrinsic, mDistCoeffs, mR, mT);
-	printf("Calibration starts with error %f\n", currError);
-	
-	std::vector<int> badImageIndices;
-
-	for (int i = 0; i < objPoints.size()-1; i++)
-	{
-		if (objPoints.size() <= 1)
-			continue;
+	const cv::Size imageSize(frameSize.height, frameSize.width);
+	if (mRejection == "leave_one_out")
+		RejectLeaveOneOut(objPoints, imgPoints, imageSize);
+	else
+		RejectByViewError(objPoints, imgPoints, imageSize);
 
-		// Temporarily remove objPoint
-		auto tempObjPoint = objPoints[i];
-		objPoints[i] = objPoints[objPoints.size() - 1];
-		objPoints.resize(objPoints.size() - 1);
+	double finalError = cv::calibrateCamera(objPoints, imgPoints, imageSize, mIntrinsic, mDistCoeffs, mR, mT);
+	printf("Calibrated camera with error %f\n", finalError);
 
-		// Temporarily remove imgPoint
-		auto tempImgPoint = imgPoints[i];
-		imgPoints[i] = imgPoints[imgPoints.size() - 1];
-		imgPoints.resize(imgPoints.size() - 1);
+	std::cout << "cameraMatrix : " << mIntrinsic << std::endl;
+	std::cout << "distCoeffs : " << mDistCoeffs << std::endl;
+}
 
-		// Calibrate
-		double newError = cv::calibrateCamera(objPoints, imgPoints, cv::Size(frame.rows, frame.cols), mIntrinsic, mDistCoeffs, mR, mT);
-		printf("Error: %f", newError);
-		if (newError <= currError - 0.01)
+/*
+	Drops the views with a reprojection error above mMaxViewErrorFactor times the median view error.
+	The per-view errors of one calibration replace a calibration per left out view,
+	a second pass catches views that only stand out once the worst are gone.
+*/
+void Camera::RejectByViewError(std::vector<std::vector<cv::Point3f>>& objPoints, std::vector<std::vector<cv::Point2f>>& imgPoints, cv::Size imageSize)
+{
+	const int passes = 2;
+	const size_t minViews = 3;
+	for (int pass = 0; pass < passes && objPoints.size() >= minViews; pass++)
+	{
+		std::vector<cv::Mat> rvecs, tvecs;
+		cv::Mat stdIntrinsics, stdExtrinsics, viewErrors;
+		double error = cv::calibrateCameraExtended(objPoints, imgPoints, imageSize, mIntrinsic, mDistCoeffs, rvecs, tvecs, stdIntrinsics, stdExtrinsics, viewErrors);
+		printf("Calibration with %zu images has error %f\n", objPoints.size(), error);
+
+		std::vector<double> errors(viewErrors.begin<double>(), viewErrors.end<double>());
+		std::vector<double> sorted = errors;
+		std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+		const double threshold = mMaxViewErrorFactor * sorted[sorted.size() / 2];
+
+		size_t rejected = std::count_if(errors.begin(), errors.end(), [threshold](double e) { return e > threshold; });
+		if (rejected == 0 || errors.size() - rejected < minViews)
+			return;
+
+		// Compact the kept views in their original order
+		size_t kept = 0;
+		for (size_t i = 0; i < errors.size(); i++)
 		{
-			// Found a better calibration, so save the index of the 'bad' image
-			printf("Potentially better calibration found by leaving out image %i\n", i);
-			printf("Objpoints.size() = %i\n", objPoints.size());
-			badImageIndices.push_back(i);
+			if (errors[i] > threshold)
+			{
+				printf("Leaving out image %zu with error %f\n", i, errors[i]);
+				continue;
+			}
+			objPoints[kept] = std::move(objPoints[i]);
+			imgPoints[kept] = std::move(imgPoints[i]);
+			kept++;
 		}
+		objPoints.resize(kept);
+		imgPoints.resize(kept);
+	}
+}
 
+/*
+	Drops every view without which the calibration error improves by at least 0.01.
+	Each left out view is calibrated on its own copy of the points, so they run in parallel.
+*/
+void Camera::RejectLeaveOneOut(std::vector<std::vector<cv::Point3f>>& objPoints, std::vector<std::vector<cv::Point2f>>& imgPoints, cv::Size imageSize)
+{
+	double currError = cv::calibrateCamera(objPoints, imgPoints, imageSize, mIntrinsic, mDistCoeffs, mR, mT);
+	printf("Calibration starts with error %f\n", currError);
 
-		// Restore the left out image on it's original index
-		objPoints.push_back(objPoints[i]);
-		objPoints[i] = tempObjPoint;
-		imgPoints.push_back(imgPoints[i]);
-		imgPoints[i] = tempImgPoint;
-	}
+	const int views = (int)objPoints.size();
+	if (views <= 1)
+		return;
 
-	// Delete the bad images
-	for (int i = badImageIndices.size() - 1; i >= 0; i--)
+	std::vector<double> errors(views);
+	cv::parallel_for_(cv::Range(0, views), [&](const cv::Range& range)
 	{
-		int index = badImageIndices[i];
-		objPoints[index] = objPoints[objPoints.size() - 1];
-		objPoints.resize(objPoints.size() - 1);
-		imgPoints[index] = imgPoints[imgPoints.size() - 1];
-		imgPoints.resize(imgPoints.size() - 1);
-	}
-	
+		for (int i = range.start; i < range.end; i++)
+		{
+			std::vector<std::vector<cv::Point3f>> objSubset(objPoints);
+			std::vector<std::vector<cv::Point2f>> imgSubset(imgPoints);
+			objSubset.erase(objSubset.begin() + i);
+			imgSubset.erase(imgSubset.begin() + i);
 
-	double finalError = cv::calibrateCamera(objPoints, imgPoints, cv::Size(frame.rows, frame.cols), mIntrinsic, mDistCoeffs, mR, mT);
-	printf("Calibrated camera with error %f\n", finalError);
+			cv::Mat intrinsic, distCoeffs, rvecs, tvecs;
+			errors[i] = cv::calibrateCamera(objSubset, imgSubset, imageSize, intrinsic, distCoeffs, rvecs, tvecs);
+		}
+	});
 
-	std::cout << "cameraMatrix : " << mIntrinsic << std::endl;
-	std::cout << "distCoeffs : " << mDistCoeffs << std::endl;
+	size_t kept = 0;
+	for (int i = 0; i < views; i++)
+	{
+		printf("Error without image %i: %f\n", i, errors[i]);
+		if (errors[i] <= currError - 0.01)
+		{
+			// Found a better calibration, so leave out the 'bad' image
+			printf("Potentially better calibration found by leaving out image %i\n", i);
+			continue;
+		}
+		objPoints[kept] = std::move(objPoints[i]);
+		imgPoints[kept] = std::move(imgPoints[i]);
+		kept++;
+	}
+	objPoints.resize(kept);
+	imgPoints.resize(kept);
 }
 
 /*
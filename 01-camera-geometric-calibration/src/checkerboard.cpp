@@ -6,6 +6,8 @@ Checkerboard::Checkerboard(const cv::FileNode& node)
 	node["Checkerboard_Width"] >> mWidth;
 	node["Checkerboard_Height"] >> mHeight;
 	node["Checkerboard_Size"] >> mCm;
+	if (!node["Checkerboard_Pyramid_Width"].empty())
+		node["Checkerboard_Pyramid_Width"] >> mPyramidWidth;
 }
 
 // We used the camera calibration from the following tutorial:
@@ -17,7 +19,8 @@ int Checkerboard::FindPoints(cv::Mat& frame, std::vector<cv::Point3f>& objPoints
 
 	// Finding checker board corners
 	// If desired number of corners are found in the image then success = true  
-	bool success = cv::findChessboardCorners(gray, cv::Size(mWidth, mHeight), imgPoints, cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_FAST_CHECK | cv::CALIB_CB_NORMALIZE_IMAGE);
+	bool success = mPyramidWidth > 0 ? FindCornersPyramid(gray, imgPoints) :
+		cv::findChessboardCorners(gray, cv::Size(mWidth, mHeight), imgPoints, cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_FAST_CHECK | cv::CALIB_CB_NORMALIZE_IMAGE);
 
 	/*
 		* If desired number of corner are detected,
@@ -35,14 +38,42 @@ int Checkerboard::FindPoints(cv::Mat& frame, std::vector<cv::Point3f>& objPoints
 		if (drawCorners)
 			cv::drawChessboardCorners(frame, cv::Size(mWidth, mHeight), imgPoints, success);
 
-		// Defining the world coordinates for 3D points
-		// We multiply our grid with the real size of the checkerboard
-		for (int i{ 0 }; i < mHeight; i++)
-		{
-			for (int j{ 0 }; j < mWidth; j++)
-				objPoints.push_back(cv::Point3f(j * mCm, i * mCm, 0));
-		}
+		objPoints = ObjectPoints();
 	}
 
 	return success;
+}
+
+std::vector<cv::Point3f> Checkerboard::ObjectPoints() const
+{
+	// Defining the world coordinates for 3D points
+	// We multiply our grid with the real size of the checkerboard
+	std::vector<cv::Point3f> objPoints;
+	for (int i{ 0 }; i < mHeight; i++)
+	{
+		for (int j{ 0 }; j < mWidth; j++)
+			objPoints.push_back(cv::Point3f(j * mCm, i * mCm, 0));
+	}
+	return objPoints;
+}
+
+bool Checkerboard::FindCornersPyramid(const cv::Mat& gray, std::vector<cv::Point2f>& imgPoints) const
+{
+	cv::Mat level = gray;
+	int scale = 1;
+	while (level.cols / 2 >= mPyramidWidth)
+	{
+		cv::Mat smaller;
+		cv::pyrDown(level, smaller);
+		level = smaller;
+		scale *= 2;
+	}
+
+	if (!cv::findChessboardCorners(level, cv::Size(mWidth, mHeight), imgPoints, cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_FAST_CHECK | cv::CALIB_CB_NORMALIZE_IMAGE))
+		return false;
+
+	// Pixel x of a level is pixel (x + 0.5) * scale - 0.5 at full resolution, cornerSubPix refines from there
+	for (auto& point : imgPoints)
+		point = (point + cv::Point2f(.5f, .5f)) * (float)scale - cv::Point2f(.5f, .5f);
+	return true;
 }
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include "cvpch.h"
+#include "corner_cache.h"
+#include "checkerboard.h"
+
+void CornerCache::Load(const std::string& path, Checkerboard const& checkerboard)
+{
+	cv::FileStorage fs(path, cv::FileStorage::READ);
+	if (!fs.isOpened())
+		return;
+
+	int width = 0, height = 0, pyramidWidth = 0;
+	fs["Checkerboard_Width"] >> width;
+	fs["Checkerboard_Height"] >> height;
+	fs["Checkerboard_Pyramid_Width"] >> pyramidWidth;
+	if (width != checkerboard.GetWidth() || height != checkerboard.GetHeight() || pyramidWidth != checkerboard.GetPyramidWidth())
+	{
+		printf("Corner cache was made with another checkerboard, searching all images again\n");
+		return;
+	}
+
+	for (const auto& node : fs["Images"])
+	{
+		std::string image;
+		Entry entry;
+		int found = 0;
+		node["Path"] >> image;
+		node["Key"] >> entry.key;
+		node["Found"] >> found;
+		node["Image_Size"] >> entry.corners.imageSize;
+		node["Corners"] >> entry.corners.corners;
+		entry.corners.found = found != 0;
+		mEntries[image] = entry;
+	}
+}
+
+void CornerCache::Save(const std::string& path, Checkerboard const& checkerboard) const
+{
+	cv::FileStorage fs(path, cv::FileStorage::WRITE);
+	if (!fs.isOpened())
+	{
+		printf("Unable to write the corner cache to %s\n", path.c_str());
+		return;
+	}
+
+	fs << "Checkerboard_Width" << checkerboard.GetWidth();
+	fs << "Checkerboard_Height" << checkerboard.GetHeight();
+	fs << "Checkerboard_Pyramid_Width" << checkerboard.GetPyramidWidth();
+	fs << "Images" << "[";
+	for (const auto& [image, entry] : mEntries)
+	{
+		fs << "{";
+		fs << "Path" << image;
+		fs << "Key" << entry.key;
+		fs << "Found" << (int)entry.corners.found;
+		fs << "Image_Size" << entry.corners.imageSize;
+		fs << "Corners" << entry.corners.corners;
+		fs << "}";
+	}
+	fs << "]";
+}
+
+bool CornerCache::Find(const std::string& image, CachedCorners& corners) const
+{
+	auto it = mEntries.find(image);
+	if (it == mEntries.end())
+		return false;
+
+	std::string key = Key(image);
+	if (key.empty() || key != it->second.key)
+		return false;
+
+	corners = it->second.corners;
+	return true;
+}
+
+void CornerCache::Store(const std::string& image, const CachedCorners& corners)
+{
+	std::string key = Key(image);
+	if (!key.empty())
+		mEntries[image] = { key, corners };
+}
+
+std::string CornerCache::Key(const std::string& image)
+{
+	std::error_code error;
+	auto size = std::filesystem::file_size(image, error);
+	if (error)
+		return "";
+	auto mtime = std::filesystem::last_write_time(image, error);
+	if (error)
+		return "";
+	return std::to_string(size) + ":" + std::to_string(mtime.time_since_epoch().count());
+}
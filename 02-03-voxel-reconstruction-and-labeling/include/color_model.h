@@ -2,14 +2,62 @@
 
 namespace team45
 {
+	/*
+	 * The bins (dominant colors) of our color models
+	 * Holds a lookup table from quantized BGR to the closest bin, so binning a pixel is a single read.
+	 * Built once and shared by all histograms.
+	 */
+	class ColorBins
+	{
+	public:
+		ColorBins(const std::vector<cv::Point3f>& bins);
+
+		static const int LUT_BITS = 5;		// Bits per channel of the lookup table (32^3 entries)
+
+		int lookup(const cv::Vec3b& bgr) const
+		{
+			const int shift = 8 - LUT_BITS;
+			return m_lut[((bgr[0] >> shift) << (2 * LUT_BITS)) | ((bgr[1] >> shift) << LUT_BITS) | (bgr[2] >> shift)];
+		}
+
+		int size() const { return (int)m_bins.size(); }
+		const std::vector<cv::Point3f>& getBins() const { return m_bins; }
+
+		size_t memoryUsage() const
+		{
+			return sizeof(ColorBins) + m_bins.capacity() * sizeof(cv::Point3f) + m_lut.capacity();
+		}
+
+	private:
+		const std::vector<cv::Point3f> m_bins;
+		std::vector<uchar> m_lut;
+	};
+
 	class Histogram
 	{
 	public:
-		Histogram(std::vector<cv::Point3f> bins) : m_bins(bins){}
+		Histogram(std::shared_ptr<const ColorBins> bins) : m_bins(bins), m_hist(bins->size(), 0.f) {}
+
+		/*
+		 * Add a pixel to the bin closest to its color
+		 */
+		void add(const cv::Vec3b& bgr)
+		{
+			m_hist[m_bins->lookup(bgr)]++;
+		}
+
+		/*
+		 * Add the bin counts of another (not yet normalized) histogram with the same bins
+		 */
+		void merge(const Histogram& other);
+
+		void clear();
+
 		/*
-		 * Calculate histogram for each channel
+		 * Call after adding all pixels
+		 * Divides every bin by the largest bin
 		 */
-		void calculate(std::vector<cv::Point3f> const& colors);
+		void normalize();
 		
 		/*
 		 * @return d(H1, H2) using Chi-Sqr
@@ -17,18 +65,23 @@ namespace team45
 		float compare(Histogram& other);
 		
 		/* 
-		 * Call after calculate()
+		 * Call after normalize()
 		 */
 		void draw();
 
 		void save(cv::FileStorage fs, std::string nodename);
 		void load(cv::FileNode fn);
+
+		size_t memoryUsage() const
+		{
+			return sizeof(Histogram) + m_hist.capacity() * sizeof(float);
+		}
 		void setId(int const& id) { m_id = id; }
 		int const& getId() const { return m_id; }
 
 	private:
-		int m_id;							// ID of person
+		int m_id = -1;						// ID of person
+		std::shared_ptr<const ColorBins> m_bins;
 		std::vector<float> m_hist;
-		const std::vector<cv::Point3f> m_bins;
 	};
-}
\ No newline at end of file
+}
@@ -16,6 +16,20 @@
 #include <complex>
 #include <valarray>
 #include <vector>
+#include <array>
+#include <map>
+#include <set>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <iomanip>
+#include <numeric>
+#include <memory_resource>
+#include <filesystem>
 
 // OpenCV 
 #include <opencv2/opencv.hpp>
@@ -39,6 +53,9 @@
 #include "GLFW/glfw3native.h"
 #endif
 #ifdef _WIN32
+// Keep Windows.h from defining min and max as macros, they break std::min and std::max
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 #include <GL/glu.h>
 #endif
@@ -53,6 +70,9 @@
 
 namespace team45
 {
+	// Cameras a voxel keeps its sampled pixels for, stored inline so the voxel owns no extra heap block
+	static const int MAX_CAMERAS = 4;
+
 	/*
 	 * Voxel structure
 	 * Represents a 3D pixel in the half space
@@ -64,14 +84,26 @@ namespace team45
 		std::vector<float> distances;				// Distance from this voxel to each camera 
 		std::vector<cv::Point> pixelProjections;	// Pixel that this voxel projects to on each camera ((-1,-1) if it doesn't project onto the camera)
 		int visibleIndex;							// Coordinates and index in m_visible_voxels (-1 if none)
+		int surfaceIndex;							// Index in m_surface_voxels (-1 if not visible or enclosed by 6 visible neighbours)
 		int camera_flags;							// Bitwise Flag if voxel was on in camera[c] in the previous frame
+		int color_cameras;							// Bitwise flag of the cameras the color was sampled from (-1 if it has to be recolored)
+		std::array<cv::Vec3b, MAX_CAMERAS> sampledPixels;	// Pixel on each camera when the color was last sampled, for the cameras in color_cameras
 	};
 
+	/*
+	 * Per instance data of a visible voxel, 8 bytes
+	 * voxel.vert computes the world position from u_Origin and u_Step
+	 */
 	struct VoxelGPU
 	{
-		glm::vec3 position;
-		glm::vec3 color;
-		glm::mat4 model;
+		uint16_t x, y, z;		// Grid coordinate
+		uint16_t color;			// RGB565
+
+		void setColor(const glm::vec3& c)
+		{
+			glm::vec3 q = glm::clamp(c, 0.f, 1.f);
+			color = (uint16_t)(((int)(q.r * 31.f + .5f) << 11) | ((int)(q.g * 63.f + .5f) << 5) | (int)(q.b * 31.f + .5f));
+		}
 	};
 
 	/*
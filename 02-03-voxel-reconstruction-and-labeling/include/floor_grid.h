@@ -0,0 +1,87 @@
+#pragma once
+
+namespace team45
+{
+	/*
+	 * 2D occupancy grid of the floor, one cell per voxel column
+	 * Each cell counts the visible voxels above it. The counts are kept up to date from the
+	 * voxels that turn on or off, so labeling people costs O(cells) instead of clustering all voxels.
+	 * The connected components are maintained from the same deltas: only the components around the
+	 * columns that became occupied or empty are filled again, the others just update their weighted centers.
+	 */
+	class FloorGrid
+	{
+		struct Component
+		{
+			int area;					// Occupied cells, 0 once the component is dissolved
+			cv::Point2d sum;			// Count-weighted sum of the cells
+			double weight;				// Sum of the counts
+			int person;					// Index in m_centers, -1 if the component is too small to be a person
+		};
+
+		cv::Point m_origin;			// World (x, y) of the first cell
+		int m_step;					// Cell size, equal to the voxel step
+
+		cv::Mat m_counts;			// CV_32S, number of visible voxels per column
+		cv::Mat m_components;		// CV_32S, 1 + the component of each occupied cell (0 = background)
+
+		std::vector<Component> m_pool;			// Components by id, the ids of dissolved components are reused
+		std::vector<int> m_free;				// Ids of dissolved components
+		std::vector<char> m_dissolved;			// Per id, whether label() already dissolved it this call
+		std::vector<cv::Point2f> m_centers;		// World (x, y) center per person component
+
+		// Scratch buffers of label(), kept so labeling does not allocate every frame
+		std::vector<cv::Point> m_flipped;		// Cells that became occupied or empty since the last label()
+		std::vector<cv::Point> m_seeds;			// Occupied cells without a component
+		std::vector<cv::Point> m_stack;			// Cells of the component being filled
+
+		void update(const cv::Point& cell, int delta);
+		bool occupied(const cv::Point& cell) const;
+		void dissolve(int id, const cv::Point& seed);
+		void fill(const cv::Point& seed);
+
+	public:
+		void init(const cv::Point& origin, const cv::Size& cells, int step);
+
+		void add(const glm::vec3& position)
+		{
+			update(cell(position), 1);
+		}
+
+		void remove(const glm::vec3& position)
+		{
+			update(cell(position), -1);
+		}
+
+		/*
+		 * Find the connected groups of occupied columns
+		 * @return The number of groups, which is the estimated number of people
+		 */
+		int label();
+
+		/*
+		 * Call after label()
+		 * @return Index of the component below the position, -1 if the column is not occupied
+		 */
+		int component(const glm::vec3& position) const
+		{
+			const int id = m_components.at<int>(cell(position)) - 1;
+			return id < 0 ? -1 : m_pool[id].person;
+		}
+
+		cv::Point cell(const glm::vec3& position) const
+		{
+			return cv::Point(((int)position.x - m_origin.x) / m_step, ((int)position.y - m_origin.y) / m_step);
+		}
+
+		const std::vector<cv::Point2f>& getCenters() const
+		{
+			return m_centers;
+		}
+
+		const cv::Mat& getCounts() const
+		{
+			return m_counts;
+		}
+	};
+}
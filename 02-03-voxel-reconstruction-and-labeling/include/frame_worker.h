@@ -0,0 +1,94 @@
+#pragma once
+
+namespace team45
+{
+	class Scene3DRenderer;
+
+	/*
+	 * Everything the render thread needs of a processed frame
+	 */
+	struct FrameSnapshot
+	{
+		int frame = -1;
+		std::vector<VoxelGPU> voxels;				// Surface voxel instances
+		std::vector<uint8_t> dirty;					// Instances that changed since the last consumed snapshot
+		std::vector<std::vector<Vertex>> tracks;	// 2D track per person
+		cv::Mat canvas;								// Video frame next to the foreground (or visibility labels)
+	};
+
+	enum class Command
+	{
+		TogglePause,
+		PreviousFrame,
+		NextFrame,
+		Seek,					// arg: frame
+		ToggleCamera,			// arg: camera
+		SaveTracking,
+		ToggleClusterMode,
+		ToggleColorMode,
+		ToggleVisibility,
+		LogMemory,
+		LogUtilization,
+		ExportMeshes,
+		ToggleMeshStreaming
+	};
+
+	/*
+	 * Processes the video frames on its own thread, so a slow reconstruction doesn't stall the
+	 * render loop and a slow draw doesn't throttle the reconstruction.
+	 * The render thread sends its key presses as commands and draws the latest published snapshot.
+	 *
+	 * Double buffered: the worker fills the back snapshot while the render thread may read the front one,
+	 * publishing swaps them. The swap waits while the render thread is consuming the front snapshot.
+	 */
+	class FrameWorker
+	{
+	public:
+		~FrameWorker();
+
+		void start(Scene3DRenderer& scene3d);
+		void stop();
+
+		void push(Command command, int arg = -1);
+
+		/*
+		 * Calls consumer with the latest snapshot, if one was published since the last call
+		 * The consumer must copy what it needs, the snapshot is reused once consumer returns
+		 * @return Whether there was a new snapshot
+		 */
+		template <typename Consumer>
+		bool consume(Consumer consumer)
+		{
+			std::lock_guard<std::mutex> lock(m_snapshot_mutex);
+			if (!m_fresh)
+				return false;
+			consumer(m_snapshots[m_front]);
+			m_fresh = false;
+			return true;
+		}
+
+	private:
+		void run();
+		void apply(Command command, int arg);
+		void publish();
+
+		Scene3DRenderer* m_scene3d = nullptr;
+
+		// Only touched by the worker thread
+		bool m_paused = true;
+		bool m_show_visibility = false;
+		bool m_republish = false;							// A command changed what's shown without a new frame
+
+		std::thread m_thread;
+		std::mutex m_command_mutex;
+		std::condition_variable m_condition;
+		bool m_stop = false;
+		std::vector<std::pair<Command, int>> m_commands;	// Filled by push()
+		std::vector<std::pair<Command, int>> m_applying;	// Owned by the worker thread, swapped with m_commands
+
+		std::mutex m_snapshot_mutex;
+		FrameSnapshot m_snapshots[2];
+		int m_front = 0;									// Snapshot the render thread reads, the other one is written
+		bool m_fresh = false;								// The front snapshot hasn't been consumed yet
+	};
+}
\ No newline at end of file
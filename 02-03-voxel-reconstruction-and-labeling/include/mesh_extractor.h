@@ -0,0 +1,63 @@
+#pragma once
+#include "ply_writer.h"
+
+namespace team45
+{
+	/*
+	 * Surface nets over the voxel occupancy grid
+	 * A cell is the cube between 8 neighbouring voxel centers. Every cell the surface passes through gets one vertex,
+	 * at the mean of the midpoints of its crossing edges. Every pair of face neighbours with a different occupancy
+	 * gets one quad, connecting the vertices of the 4 cells around the pair.
+	 *
+	 * Every voxel belongs to one of the meshes (one per person, or one for all voxels), and all meshes are built
+	 * in the same pass: a cell where two persons touch gets a vertex in both meshes.
+	 * Only the cells around the bounding box of the voxels are visited.
+	 *
+	 * The cells are processed in slabs of K_MESH_SLAB_DEPTH z-layers in parallel.
+	 * The output only depends on the slab depth, not on the number of threads.
+	 */
+	class MeshExtractor
+	{
+		struct Slab
+		{
+			int begin, end;								// Cell z-layers [begin, end)
+			std::vector<int> offsets;					// Per mesh, index of the slab's first vertex in the mesh
+			std::vector<std::vector<glm::vec3>> vertices;	// Per mesh
+			std::vector<std::vector<glm::ivec4>> quads;		// Per mesh
+		};
+
+		glm::ivec3 m_origin;					// World position of the first voxel
+		glm::ivec3 m_dimensions;				// Voxel count along x, y and z
+		int m_step = 0;
+		int m_meshes = 1;
+		std::vector<uint8_t> m_occupancy;		// Per voxel, 0 if off, otherwise 1 + the mesh it belongs to
+		glm::ivec3 m_min, m_max;				// Bounding box of the voxels in m_occupancy, empty if m_max < m_min
+		std::vector<int> m_cell_vertex;			// Per cell and mesh, index of its vertex in the mesh (-1 if none)
+		std::vector<Slab> m_slabs;
+
+		int meshAt(int x, int y, int z) const;
+		int cellIndex(int x, int y, int z) const
+		{
+			return (z * (m_dimensions.y + 1) + y) * (m_dimensions.x + 1) + x;
+		}
+		void placeVertices(Slab& slab);
+		void connectQuads(Slab& slab);
+
+	public:
+		/*
+		 * @param meshes 1 for one mesh of all voxels, K_NR_OF_PERSONS for one mesh per person
+		 */
+		void init(const glm::ivec3& origin, const glm::ivec3& dimensions, int step, int meshes);
+
+		/*
+		 * @param labels Cluster label per visible voxel, may be empty if the voxels aren't labeled
+		 * @param assignment Cluster label per person
+		 */
+		void fill(const std::vector<Voxel*>& voxels, const cv::Mat& labels, const std::vector<int>& assignment);
+
+		/*
+		 * @param meshes Resized to the number of meshes, mesh i holds the voxels of person i
+		 */
+		void extract(std::vector<PlyMesh>& meshes);
+	};
+}
\ No newline at end of file
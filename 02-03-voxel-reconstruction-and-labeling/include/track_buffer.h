@@ -0,0 +1,31 @@
+#pragma once
+
+namespace team45
+{
+	// Persistent vertex buffer of a track that only grows
+	// Only the vertices appended since the last Sync are uploaded, the capacity doubles when it runs out
+	class TrackBuffer
+	{
+	public:
+		TrackBuffer();
+		~TrackBuffer();
+		void Create(int capacity);
+		/*
+		 * Upload the vertices that were added since the last call
+		 * If the track got shorter (e.g. it was restarted), everything is uploaded again
+		 */
+		void Sync(const std::vector<Vertex>& vertices);
+		void Draw(GLenum mode = GL_POINTS) const;
+		void SetName(std::string const& name) { m_Name = name; }
+		std::string const& GetName() const { return m_Name; }
+	private:
+		void Grow(int capacity);
+		void SetAttributes() const;
+
+		std::string m_Name;
+		int m_nVertices;
+		int m_Capacity;
+		GLuint m_VAO;
+		GLuint m_VBO;
+	};
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+namespace team45
+{
+	/*
+	 * Online constant-velocity Kalman filter per person, on the floor (x, y)
+	 * Every frame is one predict and at most one correct per person, so the tracks are smoothed live.
+	 * Measurements far outside the predicted uncertainty (Mahalanobis gate) are ignored,
+	 * after too many ignored measurements in a row the track is restarted at the measurement.
+	 */
+	class Tracker
+	{
+		// Fixed-size matrices live on the stack, so a frame of tracking doesn't touch the heap
+		struct Track
+		{
+			cv::Vec4f state;						// (x, y, vx, vy)
+			cv::Matx44f covariance;
+		};
+
+		cv::Matx44f m_transition;					// One step of constant velocity per frame
+		cv::Matx44f m_process_noise;
+		cv::Matx22f m_measurement_noise;			// The measurement is the position (x, y)
+		std::vector<Track> m_tracks;
+		std::vector<int> m_misses;					// Consecutive gated measurements per person
+		std::vector<bool> m_started;
+		std::vector<cv::Point2f> m_predictions;
+
+		void start(int person, const cv::Point2f& position);
+
+	public:
+		void init(int persons);
+
+		/*
+		 * Advance every started track by one frame
+		 * @return Predicted position per person
+		 */
+		const std::vector<cv::Point2f>& predict();
+
+		/*
+		 * Call after predict()
+		 * @return Filtered position of the person
+		 */
+		cv::Point2f correct(int person, const cv::Point2f& measurement);
+
+		bool isStarted() const
+		{
+			return std::all_of(m_started.begin(), m_started.end(), [](bool b) { return b; });
+		}
+
+		const std::vector<cv::Point2f>& getPredictions() const
+		{
+			return m_predictions;
+		}
+
+		cv::Point2f getVelocity(int person) const
+		{
+			return cv::Point2f(m_tracks[person].state[2], m_tracks[person].state[3]);
+		}
+
+		/*
+		 * @return Whether the last measurement of the person was gated, so the position is a prediction
+		 */
+		bool isCoasting(int person) const
+		{
+			return m_misses[person] > 0;
+		}
+	};
+}
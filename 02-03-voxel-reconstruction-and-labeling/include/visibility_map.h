@@ -0,0 +1,47 @@
+#pragma once
+
+namespace team45
+{
+	/*
+	 * First-hit map of a single camera
+	 * Every pixel holds the closest visible voxel that projects onto it (like a z-buffer),
+	 * so occlusion tests are a few image reads instead of lookup table searches.
+	 * Rebuilt once per frame, after the voxels have been labeled.
+	 */
+	class VisibilityMap
+	{
+		cv::Mat m_depth;		// CV_32F, distance of the closest visible voxel (FLT_MAX if none)
+		cv::Mat m_index;		// CV_32S, index in the visible voxels of the closest voxel (-1 if none)
+		cv::Mat m_label;		// CV_32S, cluster label of the closest voxel (-1 if none)
+
+	public:
+		/*
+		 * Splat the visible voxels into the maps
+		 * @param labels Cluster label per visible voxel, may be empty
+		 */
+		void build(const std::vector<Voxel*>& visible, const cv::Mat& labels, int cam, const cv::Size& size);
+
+		/*
+		 * A voxel is occluded if a closer voxel is the first hit anywhere in a window around its projection
+		 * @param label Only voxels with another label occlude, pass -1 to let any voxel occlude
+		 */
+		bool isOccluded(const Voxel& voxel, int cam, int label, int radius) const;
+
+		/*
+		 * @return Index in the visible voxels of the closest voxel at the pixel, -1 if none
+		 */
+		int firstHit(const cv::Point& p) const
+		{
+			return m_index.at<int>(p);
+		}
+
+		/*
+		 * Debug view of the label image, each label in its own color
+		 */
+		cv::Mat drawLabels(const std::vector<cv::Scalar>& colors) const;
+
+		const cv::Mat& getDepth() const { return m_depth; }
+		const cv::Mat& getIndex() const { return m_index; }
+		const cv::Mat& getLabel() const { return m_label; }
+	};
+}
@@ -9,15 +9,26 @@ namespace team45
 		VoxelBuffer();
 		~VoxelBuffer();
 		void Create(int voxel_amount);
-		void Draw(const std::vector<VoxelGPU>& voxels) const;
+		/*
+		 * Uploads the instances flagged in dirty and resets the flags
+		 * Falls back to orphaning the whole buffer when most of it changed
+		 */
+		void Update(const std::vector<VoxelGPU>& voxels, std::vector<uint8_t>& dirty);
+		void Draw() const;
 		void SetName(std::string const& name) { m_Name = name; }
 		std::string const& GetName() const { return m_Name; }
 	private:
+		void Upload(const std::vector<VoxelGPU>& voxels, int begin, int end) const;
+
 		std::string m_Name;
 		int m_nVertices;
+		int m_nInstances;
+		int m_Capacity;
 		GLuint m_VAO;
 		GLuint m_VBO;
 		// Instanced VBO
 		GLuint m_IVBO;
+		// Dirty [begin, end) instance ranges of the current update, kept to avoid allocating every frame
+		std::vector<std::pair<int, int>> m_Runs;
 	};
 }
\ No newline at end of file
@@ -7,6 +7,8 @@ namespace team45
 #define MAIN_WINDOW "Checkerboard Marking"
 
 	class Histogram;
+	class ColorBins;
+	class MemoryReport;
 
 	class VoxelCamera
 	{
@@ -17,13 +19,16 @@ namespace team45
 		std::string m_video_path;							// Path to the currently opened video; 
 
 		std::vector<Histogram*> m_histograms;				// Histogram per person
-		std::vector<cv::Point3f> m_histogram_bins;				// Histogram bins
 		int m_frame_all_visible;							// Frame where all four persons are visible and seperated
 
 		// Background
 		cv::Ptr<cv::BackgroundSubtractorMOG2> m_bg_model;
 		cv::Mat m_foreground_image;							// This camera's foreground image (binary)
 		cv::Mat m_binary_diff;								// Binary difference of the current frame's foreground image and the previous frame
+		cv::Mat m_previous_foreground;						// Foreground image of the previous frame, its buffer takes the next one
+		cv::Mat m_bg_mask;									// Thresholded output of the background model
+		cv::Mat m_eroded_mask;
+		cv::Mat m_morph_kernel;								// Cleans up the background mask
 
 		cv::VideoCapture m_video;							// Video reader
 
@@ -54,7 +59,7 @@ namespace team45
 		bool initCameraProp();
 		void loadVideo(std::string path);
 		bool detIntrinsics();
-		bool findCbCorners(cv::Mat& frame, std::vector<cv::Point3f>& objPoints, std::vector<cv::Point2f>& imgPoints);
+		bool findCbCorners(const cv::Mat& gray, std::vector<cv::Point2f>& imgPoints) const;
 		void initBgModel();
 
 		static void onMouse(int, int, int, int, void*);
@@ -70,7 +75,7 @@ namespace team45
 
 		bool initialize();
 		void saveColorModels(std::vector<Histogram*>& color_models);
-		bool loadColorModels(std::vector<cv::Point3f>& bins);
+		bool loadColorModels(std::shared_ptr<const ColorBins> bins);
 
 		cv::Mat& advanceVideoFrame();
 		cv::Mat& getVideoFrame(int);
@@ -80,6 +85,11 @@ namespace team45
 		bool detExtrinsics();
 		void createForegroundImage();
 
+		/*
+		 * Add the bytes held by the cached frames and color models to the report
+		 */
+		void reportMemory(MemoryReport&) const;
+
 		cv::Point projectOnView(const cv::Point3f&, const cv::Mat&, const cv::Mat&, const cv::Mat&, const cv::Mat&);
 		cv::Point projectOnView(const cv::Point3f&);
 
@@ -142,6 +152,8 @@ namespace team45
 		{
 			m_histograms = hs;
 		}
+
+		void clearColorModels();
 	};
 
 } /* namespace team45 */
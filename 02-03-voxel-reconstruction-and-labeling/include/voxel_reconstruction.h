@@ -2,10 +2,54 @@
 #ifndef VOXELRECONSTRUCTION_H
 #define VOXELRECONSTRUCTION_H
 
+#include "floor_grid.h"
+#include "visibility_map.h"
+#include "tracker.h"
+#include "track_log.h"
+#include "mesh_extractor.h"
+
 namespace team45
 {
 	class VoxelCamera;
 	class Histogram;
+	class ColorBins;
+	class MemoryReport;
+
+	enum class ClusterMode
+	{
+		Restart,		// k-means++ with several attempts on every frame
+		WarmStart,		// Seed k-means with the previous frame's centers, restart when the clusters degrade
+		FloorGrid		// Connected components of the floor occupancy grid, warm-started k-means when they don't match the persons
+	};
+
+	inline const char* clusterModeName(ClusterMode mode)
+	{
+		switch (mode)
+		{
+		case ClusterMode::Restart: return "k-means restart";
+		case ClusterMode::WarmStart: return "warm-started k-means";
+		case ClusterMode::FloorGrid: return "floor grid";
+		}
+		return "";
+	}
+
+	enum class ColorMode
+	{
+		Labels,			// Flat color per person
+		NearestCamera,	// Pixel color of the closest camera that sees the voxel
+		Blend			// Pixel colors of all cameras that see the voxel, weighted on distance
+	};
+
+	inline const char* colorModeName(ColorMode mode)
+	{
+		switch (mode)
+		{
+		case ColorMode::Labels: return "person labels";
+		case ColorMode::NearestCamera: return "nearest camera";
+		case ColorMode::Blend: return "camera blend";
+		}
+		return "";
+	}
 
 	class VoxelReconstruction
 	{
@@ -18,55 +62,142 @@ namespace team45
 		std::vector<cv::Point3f*> m_corners;				// Cube half-space corner locations
 
 		size_t m_voxels_amount;								// Voxel count
+		glm::ivec3 m_origin;								// World position of the first voxel
+		glm::ivec3 m_dimensions;							// Voxel count along x, y and z
 		cv::Size m_plane_size;								// Camera FoV plane WxH
 
 		std::vector<Voxel*> m_voxels;						// Pointer vector to all voxels in the half-space
 		std::vector<Voxel*> m_visible_voxels;				// Pointer vector to all visible voxels
-		std::vector<VoxelGPU> m_visible_voxels_gpu;
-		cv::Mat m_labels;									// Clustering labels for each voxel
+		std::vector<Voxel*> m_changed_voxels;				// Voxels that turned on or off during this frame's updateVoxels
+		std::vector<Voxel*> m_surface_voxels;				// Visible voxels with at least one free face neighbour
+		std::vector<VoxelGPU> m_surface_voxels_gpu;
+		std::vector<uint8_t> m_surface_voxels_dirty;		// Per surface voxel, 1 if its VoxelGPU changed since the last upload
+		cv::Mat m_labels;									// Clustering labels for each voxel, a view of m_label_buffer
 		cv::Mat m_cluster_centers;							// Cluster centers for each person in the 3d voxel space
+		ClusterMode m_cluster_mode = ClusterMode::WarmStart;
+		double m_reference_compactness = 0;					// Compactness per voxel of the last full k-means restart
+		ColorMode m_color_mode = ColorMode::Labels;
+		ColorMode m_colored_mode = ColorMode::Labels;		// Mode the voxel colors were last sampled with
+
+		FloorGrid m_floor_grid;								// Visible voxels per floor column, updated with the voxels
+		int m_estimated_persons = 0;						// Number of people according to the floor grid
 
 		// Lookup table per camera, where a pixel (y * width + x) maps to all of the voxels that are projected onto it   
 		std::vector<std::map<int, std::vector<Voxel*>>> m_lookup;
+		// First-hit map per camera of the visible voxels, rebuilt every frame after labeling
+		std::vector<VisibilityMap> m_visibility;
 
 		int m_all_camera_flags;
 		bool m_saved_2d_tracking = false;
 
-		std::vector<cv::Point3f> m_bins;
-		const std::vector<std::vector<int>> m_permutations;
+		std::shared_ptr<const ColorBins> m_bins;				// Color model bins, shared by all histograms
 
 		std::vector<std::vector<Vertex>> m_2d_tracking;	// Keeping track of 2d coordinates per person, over time
+		std::vector<int> m_assignment;						// Cluster label per person of the current frame
+		Tracker m_tracker;									// Filtered floor position per person
+		TrackLogWriter m_track_log;							// Streams the filtered positions to disk
+		std::vector<TrackRecord> m_track_records;			// Records of the current frame
+		MeshExtractor m_mesh_extractor;
+		PlyWriter m_ply_writer;								// Writes the meshes in the background
+		bool m_stream_meshes = false;						// Export the meshes of every frame
+		int m_frame_nr = 0;									// Frame of the last update
+
+		// Per-frame working memory, only ever grows, so a steady-state update() does not allocate
+		std::vector<cv::Point2f> m_voxel_points;			// Floor (x, y) per visible voxel
+		std::vector<int> m_label_buffer;					// Storage behind m_labels
+		std::vector<std::vector<Histogram>> m_frame_models;					// Color model per camera, per cluster
+		std::vector<std::vector<Histogram*>> m_frame_model_order;			// The same models, ordered on matched person
+		std::vector<std::vector<std::vector<Histogram>>> m_partial_models;	// Partial color models per camera, per voxel chunk, per cluster
+		std::vector<std::byte> m_arena_buffer;
+		std::pmr::monotonic_buffer_resource m_frame_arena;	// Short-lived containers of a frame, released at the start of every update()
+		std::vector<float> m_seed_distances;				// k-means++ distance per voxel to the closest center so far
+		std::vector<int> m_best_labels;						// Labels of the most compact k-means++ attempt so far
+		std::mt19937 m_rng;									// Picks the k-means++ seeds
+		long m_updates = 0;
 
 		void initVoxels(int offsetX, int offsetY);
+		void reserveFrameBuffers();
 		void updateVoxels();
 		void labelVoxels();
-		void trackClusters(int permutation);
-		void colorVoxels(int permutation);
-		bool colorVoxel(Voxel* voxel, int cam);
+		double warmStartKmeans();
+		double restartKmeans();
+		double lloyd(cv::Point2f* centers, int maxIterations, double epsilon);
+		bool labelFloorGrid();
+		void resizeLabels(int rows);
+		void updateVisibility();
+		void trackClusters(int frameNr, const std::vector<int>& assignment);
+		void colorVoxels(const std::vector<int>& assignment);
+		void sampleVoxelColors();
+		bool pixelChanged(const Voxel& voxel, int cam) const;
+		void updateSurface();
+		void refreshSurface(Voxel* voxel);
+		Voxel* voxelAt(int x, int y, int z) const;
 		VoxelGPU createVoxelGPU(Voxel const& voxel);
+		void setVoxelColor(Voxel* voxel, const glm::vec3& color);
+		void exportMeshes();
 		/*
 		 * Call after voxels have been labeled
+		 * Fills m_frame_models[cam], one model per cluster
 		 */
-		void createColorModels(int cam, std::vector<Histogram*>&);
-		int matchClusters();
+		void createColorModels(int cam);
+		const std::vector<int>& matchClusters();
 		void initColorModels();
+		void bootstrapColorModels();
+		void createColorModelsByHand(int cam);
+		void labelFrame(int frameNr);
 		void initBins();
-		float matchModels(std::vector<Histogram*>&, std::vector<Histogram*>&, int& outPermutation);
+		float matchModels(std::vector<Histogram*>&, std::vector<Histogram*>&, std::pmr::vector<int>& outAssignment);
 
 	public:
 		VoxelReconstruction(const std::vector<VoxelCamera*>&, int height, int step);
 		virtual ~VoxelReconstruction();
 
-		void update();
+		/*
+		 * Reconstruct, label and track the current frames of the cameras
+		 * @param frameNr Video frame of the cameras, recorded in the track log
+		 */
+		void update(int frameNr);
 
 		const std::vector<Voxel*>& getVisibleVoxels() const
 		{
 			return m_visible_voxels;
 		}
 
-		const std::vector<VoxelGPU>& getVisibleVoxelsGPU() const
+		/*
+		 * Enclosed voxels can never be seen, so only these are rendered
+		 */
+		const std::vector<Voxel*>& getSurfaceVoxels() const
+		{
+			return m_surface_voxels;
+		}
+
+		const std::vector<VoxelGPU>& getSurfaceVoxelsGPU() const
+		{
+			return m_surface_voxels_gpu;
+		}
+
+		/*
+		 * Instances that have to be uploaded again, same size as getSurfaceVoxelsGPU()
+		 * The consumer resets the flags after uploading
+		 */
+		std::vector<uint8_t>& getDirtySurfaceVoxelsGPU()
+		{
+			return m_surface_voxels_dirty;
+		}
+
+		int getEstimatedPersons() const
+		{
+			return m_estimated_persons;
+		}
+
+		const VisibilityMap& getVisibility(int cam) const
+		{
+			return m_visibility[cam];
+		}
+
+		const FloorGrid& getFloorGrid() const
 		{
-			return m_visible_voxels_gpu;
+			return m_floor_grid;
 		}
 
 		const std::vector<Voxel*>& getVoxels() const
@@ -74,6 +205,41 @@ namespace team45
 			return m_voxels;
 		}
 
+		void toggleClusterMode()
+		{
+			m_cluster_mode = (ClusterMode)(((int)m_cluster_mode + 1) % ((int)ClusterMode::FloorGrid + 1));
+		}
+
+		ClusterMode getClusterMode() const
+		{
+			return m_cluster_mode;
+		}
+
+		void toggleColorMode()
+		{
+			m_color_mode = (ColorMode)(((int)m_color_mode + 1) % ((int)ColorMode::Blend + 1));
+			// Recolor right away, also when paused
+			colorVoxels(m_assignment);
+		}
+
+		/*
+		 * Export the meshes of the current frame, also when paused
+		 */
+		void requestMeshExport()
+		{
+			exportMeshes();
+		}
+
+		bool toggleMeshStreaming()
+		{
+			return m_stream_meshes = !m_stream_meshes;
+		}
+
+		ColorMode getColorMode() const
+		{
+			return m_color_mode;
+		}
+
 		void toggleCamera(const int& cam_id)
 		{
 			if (cam_id >= 0 && cam_id < m_toggle_camera.size())
@@ -103,14 +269,27 @@ namespace team45
 			return m_step;
 		}
 
+		const glm::ivec3& getOrigin() const
+		{
+			return m_origin;
+		}
+
 		const std::vector<std::vector<Vertex>>& get2dTracking() const
 		{
 			return m_2d_tracking;
 		}
 		
-		void smooth2dTracking();
 		void save2dTracking();
 
+		/*
+		 * Add the bytes held by the voxel space, lookup tables and per-frame structures to the report
+		 */
+		void reportMemory(MemoryReport&) const;
+		/*
+		 * Log the memory of the reconstruction and all of its cameras
+		 */
+		void logMemory() const;
+
 	};
 
 } /* namespace team45 */
@@ -8,6 +8,8 @@ namespace team45
 	class Shader;
 	class VertexBuffer;
 	class VoxelBuffer;
+	class TrackBuffer;
+	class FrameWorker;
 
 	// https://stackoverflow.com/questions/1008019/c-singleton-design-pattern
 	class Window
@@ -15,7 +17,6 @@ namespace team45
 		Window() {};
 
 		float m_deltaTime = 0;
-		bool m_paused = true;
 		bool m_draw_voxels = true;
 
 		glm::vec4 m_clear_color;
@@ -35,6 +36,11 @@ namespace team45
 		VertexBuffer* m_volume_vb = nullptr;
 
 		VoxelBuffer* m_voxel_buffer = nullptr;
+		std::vector<TrackBuffer*> m_track_buffers;		// One per person
+
+		FrameWorker* m_worker = nullptr;				// Processes the video frames
+		cv::Mat m_canvas;								// Video window image of the last consumed snapshot
+		int m_trackbar_pos = 0;							// Frame slider position set by the window, anything else was dragged
 
 		bool m_rotate_camera = false;
 		bool m_reset_cursor = false;
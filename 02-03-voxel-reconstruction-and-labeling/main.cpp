@@ -4,6 +4,9 @@
 #include "window.h"
 #include "voxel_reconstruction.h"
 #include "scene_renderer.h"
+#include "tracer.h"
+#include "task_pool.h"
+#include "alloc_counter.h"
 
 using namespace team45;
 
@@ -26,7 +29,14 @@ void showKeys()
 	std::cout << "	r           : Rotate camera around scene"	<< std::endl;
 	std::cout << "	1,2,3,4     : Toggle voxel camera #"		<< std::endl;
 	std::cout << "	v			: Toggle draw voxels"			<< std::endl;
-	std::cout << "	c			: Smooth and save tracking"		<< std::endl;
+	std::cout << "	c			: Save tracking"				<< std::endl;
+	std::cout << "	k			: Switch clustering mode"			<< std::endl;
+	std::cout << "	m			: Log memory usage"				<< std::endl;
+	std::cout << "	u			: Log task pool utilization"	<< std::endl;
+	std::cout << "	o			: Toggle visibility map view"	<< std::endl;
+	std::cout << "	t			: Switch voxel color mode"		<< std::endl;
+	std::cout << "	e			: Export meshes of this frame"	<< std::endl;
+	std::cout << "	x			: Toggle mesh export every frame"	<< std::endl;
 	std::cout << "	p           : Pause"						<< std::endl;
 	std::cout << "	b           : Frame back"					<< std::endl;
 	std::cout << "	n           : Next frame"					<< std::endl << std::endl;
@@ -75,6 +85,12 @@ void initCameras()
 int main(int argc, char** argv)
 {
 	log::init();
+	alloc_counter::init();
+#ifdef TEAM45_TRACING
+	tracer::init(util::DATA_DIR_STR + util::TRACE_FILE);
+#endif
+	// Started before anything runs in parallel, every stage shares the same workers
+	TaskPool::get().init({ util::TASK_POOL_THREADS, util::TASK_POOL_PIN });
 	showKeys();
 	getCameraData();
 	initCameras();
@@ -86,6 +102,8 @@ int main(int argc, char** argv)
 	Window::GetInstance().init(util::SCENE_WINDOW.c_str(), scene3d);
 	Window::GetInstance().run();
 
+	TaskPool::get().shutdown();
+	tracer::shutdown();
 
 	log::shutdown();
 	for (size_t v = 0; v < m_cam_views.size(); ++v)
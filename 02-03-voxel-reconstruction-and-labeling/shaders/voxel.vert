@@ -1,15 +1,19 @@
 #version 330 core
 
 layout (location = 0) in vec3 a_Position;
-layout (location = 1) in vec3 a_Color;
-layout (location = 2) in mat4 a_Model;
+layout (location = 1) in uvec3 a_Grid;
+layout (location = 2) in uint a_Color;
 
 out vec4 Color;
 
 uniform mat4 u_ProjectionView;
+uniform vec3 u_Origin;
+uniform float u_Step;
 
 void main()
 {
-    gl_Position = u_ProjectionView * a_Model * vec4(a_Position, 1.0);
-    Color = vec4(a_Color, 1.0);
+    vec3 world = u_Origin + (vec3(a_Grid) + a_Position) * u_Step;
+    gl_Position = u_ProjectionView * vec4(world, 1.0);
+    // Unpack RGB565
+    Color = vec4(float((a_Color >> 11u) & 31u) / 31.0, float((a_Color >> 5u) & 63u) / 63.0, float(a_Color & 31u) / 31.0, 1.0);
 }
\ No newline at end of file
@@ -1,33 +1,59 @@
 #include "cvpch.h"
 #include "color_model.h"
 #include "util.h"
+#include "task_pool.h"
 
 using namespace cv;
 namespace team45
 {
-	void Histogram::calculate(std::vector<cv::Point3f>const& colors)
+	ColorBins::ColorBins(const std::vector<cv::Point3f>& bins) : m_bins(bins)
 	{
-		m_hist.resize(m_bins.size());
+		// One entry per quantized color, holding the bin closest to the center of its cell
+		const int levels = 1 << LUT_BITS;
+		const float cell = 256.f / levels;
+		m_lut.resize(levels * levels * levels);
 
-		// For each color that we find, calculate the distance to each bin
-		for (int i = 0; i < colors.size(); i++)
+		TaskPool::get().parallelFor(0, levels, 1, [&](int b)
 		{
-			double shortestDist = DBL_MAX;
-			int closestBin = 0;
-			for (int b = 0; b < m_bins.size(); b++)
+			for (int g = 0; g < levels; g++)
 			{
-				cv::Vec3f v = colors[i] - m_bins[b];
-				// Is actually |v|^2, but does not matter
-				double distance = v.dot(v);
-				if (distance < shortestDist)
+				for (int r = 0; r < levels; r++)
 				{
-					closestBin = b;
-					shortestDist = distance;
+					cv::Point3f color((b + .5f) * cell, (g + .5f) * cell, (r + .5f) * cell);
+
+					float shortestDist = FLT_MAX;
+					int closestBin = 0;
+					for (int i = 0; i < m_bins.size(); i++)
+					{
+						cv::Point3f v = color - m_bins[i];
+						// Is actually |v|^2, but does not matter
+						float distance = v.dot(v);
+						if (distance < shortestDist)
+						{
+							closestBin = i;
+							shortestDist = distance;
+						}
+					}
+					m_lut[(b * levels + g) * levels + r] = (uchar)closestBin;
 				}
 			}
-			m_hist[closestBin]++;
-		}
+		});
+	}
 
+	void Histogram::merge(const Histogram& other)
+	{
+		assert(m_hist.size() == other.m_hist.size());
+		for (int b = 0; b < m_hist.size(); b++)
+			m_hist[b] += other.m_hist[b];
+	}
+
+	void Histogram::clear()
+	{
+		std::fill(m_hist.begin(), m_hist.end(), 0.f);
+	}
+
+	void Histogram::normalize()
+	{
 		// Normalize our histogram by dividing every element by the maximum element;
 		float maxElem = -1;
 		for (int b = 0; b < m_hist.size(); b++)
@@ -38,6 +64,10 @@ namespace team45
 			}
 		}
 
+		// No pixels were added, so there is nothing to normalize
+		if (maxElem <= 0)
+			return;
+
 		for (int b = 0; b < m_hist.size(); b++)
 			m_hist[b] /= maxElem;
 	}
@@ -51,8 +81,11 @@ namespace team45
 		// Chi-Squared dist
 		for (int b = 0; b < m_hist.size(); b++)
 		{
+			float sum = m_hist[b] + other.m_hist[b];
+			// Empty in both histograms, so no difference (and no division by zero)
+			if (sum <= 0) continue;
 			float diff = (m_hist[b] - other.m_hist[b]);
-			d += diff * diff / (float)(m_hist[b] + other.m_hist[b]);
+			d += diff * diff / sum;
 		}
 
 		// Intersection
@@ -77,7 +110,7 @@ namespace team45
 			rectangle(hist_image,
 				Point2f(bin_w * (i + .5f), hist_h),
 				Point2f(bin_w * (i + 1.5f), hist_h - m_hist[i] * hist_h),
-				Scalar(m_bins[i].x, m_bins[i].y, m_bins[i].z), -2, 8, 0);
+				Scalar(m_bins->getBins()[i].x, m_bins->getBins()[i].y, m_bins->getBins()[i].z), -2, 8, 0);
 		}
 
 		// Display
@@ -0,0 +1,189 @@
+#include "cvpch.h"
+#include "floor_grid.h"
+#include "util.h"
+
+namespace team45
+{
+	void FloorGrid::init(const cv::Point& origin, const cv::Size& cells, int step)
+	{
+		m_origin = origin;
+		m_step = step;
+		m_counts = cv::Mat::zeros(cells, CV_32S);
+		m_components = cv::Mat::zeros(cells, CV_32S);
+		m_pool.clear();
+		m_free.clear();
+		m_dissolved.clear();
+		m_centers.clear();
+		m_flipped.clear();
+		// There are never more components than cells, so the pool and centers never grow after init
+		m_pool.reserve(cells.area());
+		m_free.reserve(cells.area());
+		m_dissolved.reserve(cells.area());
+		m_centers.reserve(cells.area());
+		m_flipped.reserve(cells.area());
+		m_seeds.reserve(cells.area());
+		m_stack.reserve(cells.area());
+	}
+
+	// Columns with only a few voxels are usually noise, not people
+	bool FloorGrid::occupied(const cv::Point& cell) const
+	{
+		return m_counts.at<int>(cell) >= util::K_GRID_MIN_COLUMN;
+	}
+
+	void FloorGrid::update(const cv::Point& cell, int delta)
+	{
+		const bool before = occupied(cell);
+		m_counts.at<int>(cell) += delta;
+		if (before != occupied(cell))
+		{
+			// The shape of the components around the cell changes, label() fills them again
+			m_flipped.push_back(cell);
+			return;
+		}
+
+		// The cell stays in its component, only the weight changes
+		const int id = m_components.at<int>(cell) - 1;
+		if (before && id >= 0)
+		{
+			m_pool[id].sum += cv::Point2d(cell) * delta;
+			m_pool[id].weight += delta;
+		}
+	}
+
+	int FloorGrid::label()
+	{
+		const int rows = m_counts.rows, cols = m_counts.cols;
+
+		// A flipped cell can split, merge or resize the components around it, so those are dissolved.
+		// The other components can't touch the flipped cells, so they keep their cells
+		m_seeds.clear();
+		for (const cv::Point& flipped : m_flipped)
+		{
+			for (int dy = -1; dy <= 1; dy++)
+			{
+				for (int dx = -1; dx <= 1; dx++)
+				{
+					const cv::Point n(flipped.x + dx, flipped.y + dy);
+					if (n.x < 0 || n.y < 0 || n.x >= cols || n.y >= rows) continue;
+					const int id = m_components.at<int>(n) - 1;
+					if (id >= 0 && !m_dissolved[id])
+						dissolve(id, n);
+				}
+			}
+			if (occupied(flipped))
+				m_seeds.push_back(flipped);
+		}
+		m_flipped.clear();
+
+		// Flood fill the occupied cells that lost (or never had) their component
+		for (const cv::Point& seed : m_seeds)
+			if (m_components.at<int>(seed) == 0 && occupied(seed))
+				fill(seed);
+
+		// Number the components that are large enough to be a person, in id order
+		m_centers.clear();
+		for (auto& component : m_pool)
+		{
+			component.person = -1;
+			if (component.area < util::K_GRID_MIN_CELLS)
+				continue;
+
+			// Count-weighted center in world coordinates
+			cv::Point2d cell = component.sum / component.weight;
+			component.person = (int)m_centers.size();
+			m_centers.push_back(cv::Point2f(
+				(float)(m_origin.x + cell.x * m_step),
+				(float)(m_origin.y + cell.y * m_step)));
+		}
+
+		return (int)m_centers.size();
+	}
+
+	/*
+	 * Clear the cells of a component, the ones that are still occupied are filled again
+	 * The cells of a component are 8-connected, so they are found from any one of them
+	 */
+	void FloorGrid::dissolve(int id, const cv::Point& seed)
+	{
+		const int rows = m_counts.rows, cols = m_counts.cols;
+		m_stack.clear();
+		m_stack.push_back(seed);
+		m_components.at<int>(seed) = 0;
+		size_t top = 0;
+		while (top < m_stack.size())
+		{
+			const cv::Point cell = m_stack[top++];
+			if (occupied(cell))
+				m_seeds.push_back(cell);
+
+			for (int dy = -1; dy <= 1; dy++)
+			{
+				for (int dx = -1; dx <= 1; dx++)
+				{
+					const cv::Point n(cell.x + dx, cell.y + dy);
+					if (n.x < 0 || n.y < 0 || n.x >= cols || n.y >= rows) continue;
+					if (m_components.at<int>(n) != id + 1) continue;
+					m_components.at<int>(n) = 0;
+					m_stack.push_back(n);
+				}
+			}
+		}
+
+		m_pool[id].area = 0;
+		m_dissolved[id] = 1;
+		m_free.push_back(id);
+	}
+
+	/*
+	 * Flood fill the occupied columns (8-connected) into a new component, in the reused buffers instead of
+	 * cv::connectedComponentsWithStats, which allocates its own on every call
+	 */
+	void FloorGrid::fill(const cv::Point& seed)
+	{
+		int id;
+		if (m_free.empty())
+		{
+			id = (int)m_pool.size();
+			m_pool.push_back(Component());
+			m_dissolved.push_back(0);
+		}
+		else
+		{
+			id = m_free.back();
+			m_free.pop_back();
+		}
+		m_dissolved[id] = 0;
+
+		const int rows = m_counts.rows, cols = m_counts.cols;
+		Component& component = m_pool[id];
+		component.area = 0;
+		component.sum = cv::Point2d(0, 0);
+		component.weight = 0;
+
+		m_stack.clear();
+		m_stack.push_back(seed);
+		m_components.at<int>(seed) = id + 1;
+		size_t top = 0;
+		while (top < m_stack.size())
+		{
+			const cv::Point cell = m_stack[top++];
+			const int count = m_counts.at<int>(cell);
+			component.sum += cv::Point2d(cell) * count;
+			component.weight += count;
+			component.area++;
+
+			for (int dy = -1; dy <= 1; dy++)
+			{
+				for (int dx = -1; dx <= 1; dx++)
+				{
+					const cv::Point n(cell.x + dx, cell.y + dy);
+					if (n.x < 0 || n.y < 0 || n.x >= cols || n.y >= rows) continue;
+					if (m_components.at<int>(n) != 0 || !occupied(n)) continue;
+					m_components.at<int>(n) = id + 1;
+					m_stack.push_back(n);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,227 @@
+#include "cvpch.h"
+#include "frame_worker.h"
+
+#include "util.h"
+#include "voxel_camera.h"
+#include "voxel_reconstruction.h"
+#include "scene_renderer.h"
+#include "tracer.h"
+#include "task_pool.h"
+
+namespace team45
+{
+	FrameWorker::~FrameWorker()
+	{
+		stop();
+	}
+
+	void FrameWorker::start(Scene3DRenderer& scene3d)
+	{
+		if (m_thread.joinable())
+			return;
+		m_scene3d = &scene3d;
+		m_stop = false;
+		m_thread = std::thread(&FrameWorker::run, this);
+	}
+
+	void FrameWorker::stop()
+	{
+		if (!m_thread.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(m_command_mutex);
+			m_stop = true;
+		}
+		m_condition.notify_one();
+		m_thread.join();
+	}
+
+	void FrameWorker::push(Command command, int arg)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_command_mutex);
+			m_commands.push_back({ command, arg });
+		}
+		m_condition.notify_one();
+	}
+
+	void FrameWorker::run()
+	{
+		if (tracer::enabled())
+			tracer::setThreadName("Frame worker");
+		Scene3DRenderer& scene3d = *m_scene3d;
+
+		while (true)
+		{
+			{
+				// Sleep while paused, until a command arrives
+				std::unique_lock<std::mutex> lock(m_command_mutex);
+				m_condition.wait(lock, [&] {
+					return m_stop || !m_commands.empty() || !m_paused || scene3d.getCurrentFrame() != scene3d.getPreviousFrame();
+				});
+				if (m_stop)
+					return;
+				std::swap(m_commands, m_applying);
+			}
+
+			for (auto& command : m_applying)
+				apply(command.first, command.second);
+			m_applying.clear();
+
+			if (scene3d.getCurrentFrame() > scene3d.getNumberOfFrames() - 2)
+			{
+				// Save the 2D tracking points
+				scene3d.getReconstructor().save2dTracking();
+
+				// Go to the start of the video if we've moved beyond the end
+				scene3d.setCurrentFrame(0);
+				for (size_t c = 0; c < scene3d.getCameras().size(); ++c)
+					scene3d.getCameras()[c]->setVideoFrame(scene3d.getCurrentFrame());
+			}
+			if (scene3d.getCurrentFrame() < 0)
+			{
+				// Go to the end of the video if we've moved before the start
+				scene3d.setCurrentFrame(scene3d.getNumberOfFrames() - 2);
+				for (size_t c = 0; c < scene3d.getCameras().size(); ++c)
+					scene3d.getCameras()[c]->setVideoFrame(scene3d.getCurrentFrame());
+			}
+			if (!m_paused)
+			{
+				// If not paused move to the next frame
+				scene3d.setCurrentFrame(scene3d.getCurrentFrame() + 1);
+			}
+			if (scene3d.getCurrentFrame() != scene3d.getPreviousFrame())
+			{
+				// If the current frame is different from the last iteration update stuff
+				scene3d.processFrame();
+				scene3d.getReconstructor().update(scene3d.getCurrentFrame());
+				scene3d.setPreviousFrame(scene3d.getCurrentFrame());
+				m_republish = true;
+			}
+
+			if (m_republish)
+			{
+				publish();
+				m_republish = false;
+			}
+		}
+	}
+
+	void FrameWorker::apply(Command command, int arg)
+	{
+		Scene3DRenderer& scene3d = *m_scene3d;
+		VoxelReconstruction& reconstructor = scene3d.getReconstructor();
+		switch (command)
+		{
+		case Command::TogglePause:
+			m_paused = !m_paused;
+			break;
+		case Command::PreviousFrame:
+			scene3d.setCurrentFrame(scene3d.getCurrentFrame() - 1);
+			break;
+		case Command::NextFrame:
+			scene3d.setCurrentFrame(scene3d.getCurrentFrame() + 1);
+			break;
+		case Command::Seek:
+			scene3d.setCurrentFrame(arg);
+			break;
+		case Command::ToggleCamera:
+			scene3d.toggleCamera(arg);
+			m_republish = true;
+			break;
+		case Command::SaveTracking:
+			// Save the 2D tracking points
+			reconstructor.save2dTracking();
+			break;
+		case Command::ToggleClusterMode:
+			reconstructor.toggleClusterMode();
+			INFO("Clustering with {}", clusterModeName(reconstructor.getClusterMode()));
+			break;
+		case Command::ToggleColorMode:
+			reconstructor.toggleColorMode();
+			INFO("Coloring voxels with {}", colorModeName(reconstructor.getColorMode()));
+			m_republish = true;
+			break;
+		case Command::ToggleVisibility:
+			m_show_visibility = !m_show_visibility;
+			m_republish = true;
+			break;
+		case Command::LogMemory:
+			reconstructor.logMemory();
+			break;
+		case Command::LogUtilization:
+			TaskPool::get().logUtilization();
+			TaskPool::get().resetUtilization();
+			break;
+		case Command::ExportMeshes:
+			reconstructor.requestMeshExport();
+			break;
+		case Command::ToggleMeshStreaming:
+			INFO("Mesh export of every frame {}", reconstructor.toggleMeshStreaming() ? "on" : "off");
+			break;
+		}
+	}
+
+	/*
+	 * Copies the frame's result into the back snapshot and swaps it to the front
+	 */
+	void FrameWorker::publish()
+	{
+		TRACE_SCOPE("publish");
+		Scene3DRenderer& scene3d = *m_scene3d;
+		VoxelReconstruction& reconstructor = scene3d.getReconstructor();
+		FrameSnapshot& back = m_snapshots[1 - m_front];
+
+		back.frame = scene3d.getCurrentFrame();
+		back.voxels.assign(reconstructor.getSurfaceVoxelsGPU().begin(), reconstructor.getSurfaceVoxelsGPU().end());
+		std::vector<uint8_t>& dirty = reconstructor.getDirtySurfaceVoxelsGPU();
+		back.dirty.assign(dirty.begin(), dirty.end());
+		std::fill(dirty.begin(), dirty.end(), 0);
+
+		// The tracks only grow, so only the new positions are copied
+		const auto& tracks = reconstructor.get2dTracking();
+		back.tracks.resize(tracks.size());
+		for (size_t i = 0; i < tracks.size(); i++)
+		{
+			if (back.tracks[i].size() > tracks[i].size())
+				back.tracks[i].clear();
+			back.tracks[i].insert(back.tracks[i].end(), tracks[i].begin() + back.tracks[i].size(), tracks[i].end());
+		}
+
+		// Concatenate the video frame with the foreground image (of set camera)
+		int cam = scene3d.getCurrentCamera() != -1 ? scene3d.getCurrentCamera() : scene3d.getPreviousCamera();
+		const cv::Mat& frame = scene3d.getCameras()[cam]->getFrame();
+		const cv::Mat& foreground = scene3d.getCameras()[cam]->getForegroundImage();
+		if (!frame.empty() && !foreground.empty())
+		{
+			cv::Mat fg_im_3c;
+			if (m_show_visibility)
+			{
+				// Show which cluster is the first hit per pixel instead of the foreground
+				static std::vector<cv::Scalar> colors{ {0,0,255}, {0,255,0}, {255,0,0}, {255,0,255} };
+				fg_im_3c = reconstructor.getVisibility(cam).drawLabels(colors);
+			}
+			else
+			{
+				cvtColor(foreground, fg_im_3c, CV_GRAY2BGR);
+			}
+			hconcat(frame, fg_im_3c, back.canvas);
+		}
+		else
+		{
+			frame.copyTo(back.canvas);
+		}
+
+		std::lock_guard<std::mutex> lock(m_snapshot_mutex);
+		if (m_fresh)
+		{
+			// The render thread skipped the front snapshot, so its changes still have to be uploaded
+			const FrameSnapshot& skipped = m_snapshots[m_front];
+			const size_t common = std::min(skipped.dirty.size(), back.dirty.size());
+			for (size_t i = 0; i < common; i++)
+				back.dirty[i] |= skipped.dirty[i];
+		}
+		m_front = 1 - m_front;
+		m_fresh = true;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,250 @@
+#include "cvpch.h"
+#include "mesh_extractor.h"
+#include "util.h"
+#include "tracer.h"
+#include "task_pool.h"
+
+namespace team45
+{
+	void MeshExtractor::init(const glm::ivec3& origin, const glm::ivec3& dimensions, int step, int meshes)
+	{
+		m_origin = origin;
+		m_dimensions = dimensions;
+		m_step = step;
+		m_meshes = meshes;
+		m_occupancy.assign((size_t)dimensions.x * dimensions.y * dimensions.z, 0);
+		m_min = glm::ivec3(0);
+		m_max = glm::ivec3(-1);
+		// One cell more than voxels along every axis, so the cells on the border close the surface
+		m_cell_vertex.assign((size_t)(dimensions.x + 1) * (dimensions.y + 1) * (dimensions.z + 1) * meshes, -1);
+
+		m_slabs.clear();
+		for (int z = 0; z <= dimensions.z; z += util::K_MESH_SLAB_DEPTH)
+		{
+			Slab slab;
+			slab.begin = z;
+			slab.end = std::min(z + util::K_MESH_SLAB_DEPTH, dimensions.z + 1);
+			slab.offsets.resize(meshes, 0);
+			slab.vertices.resize(meshes);
+			slab.quads.resize(meshes);
+			m_slabs.push_back(slab);
+		}
+	}
+
+	void MeshExtractor::fill(const std::vector<Voxel*>& voxels, const cv::Mat& labels, const std::vector<int>& assignment)
+	{
+		TRACE_SCOPE("fillOccupancy");
+		std::array<int, util::K_NR_OF_PERSONS> personOf;
+		personOf.fill(0);
+		for (int i = 0; i < assignment.size(); i++)
+			personOf[assignment[i]] = i;
+		const bool labeled = m_meshes > 1 && labels.rows == voxels.size();
+
+		// Only the previous bounding box can hold voxels
+		for (int z = m_min.z; z <= m_max.z; z++)
+			for (int y = m_min.y; y <= m_max.y; y++)
+			{
+				auto row = m_occupancy.begin() + ((size_t)z * m_dimensions.y + y) * m_dimensions.x;
+				std::fill(row + m_min.x, row + m_max.x + 1, 0);
+			}
+
+		m_min = m_dimensions;
+		m_max = glm::ivec3(-1);
+		for (auto voxel : voxels)
+		{
+			const glm::ivec3 grid = (glm::ivec3(voxel->position) - m_origin) / m_step;
+			m_min = glm::min(m_min, grid);
+			m_max = glm::max(m_max, grid);
+		}
+
+		TaskPool::get().parallelFor(0, (int)voxels.size(), 4096, [&](int v)
+		{
+			const glm::ivec3 grid = (glm::ivec3(voxels[v]->position) - m_origin) / m_step;
+			const size_t index = ((size_t)grid.z * m_dimensions.y + grid.y) * m_dimensions.x + grid.x;
+			m_occupancy[index] = (uint8_t)(1 + (labeled ? personOf[labels.at<int>(v)] : 0));
+		});
+	}
+
+	/*
+	 * @return The mesh the voxel belongs to, -1 if it's off or outside the grid
+	 */
+	int MeshExtractor::meshAt(int x, int y, int z) const
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= m_dimensions.x || y >= m_dimensions.y || z >= m_dimensions.z)
+			return -1;
+		return m_occupancy[((size_t)z * m_dimensions.y + y) * m_dimensions.x + x] - 1;
+	}
+
+	void MeshExtractor::extract(std::vector<PlyMesh>& meshes)
+	{
+		TRACE_SCOPE("extractMeshes");
+		const int slabs = (int)m_slabs.size();
+
+		TaskPool::get().parallelFor(0, slabs, 1, [&](int s) { placeVertices(m_slabs[s]); });
+
+		// Slab order decides the vertex order, so the meshes don't depend on the thread count
+		std::vector<int> vertices(m_meshes, 0);
+		for (auto& slab : m_slabs)
+		{
+			for (int m = 0; m < m_meshes; m++)
+			{
+				slab.offsets[m] = vertices[m];
+				vertices[m] += (int)slab.vertices[m].size();
+			}
+		}
+
+		// The quads of a slab also use the vertices of the layer below it, so all vertices are placed first
+		TaskPool::get().parallelFor(0, slabs, 1, [&](int s) { connectQuads(m_slabs[s]); });
+
+		meshes.resize(m_meshes);
+		for (int m = 0; m < m_meshes; m++)
+		{
+			PlyMesh& mesh = meshes[m];
+			mesh.clear();
+			mesh.vertices.reserve(vertices[m]);
+			for (auto& slab : m_slabs)
+			{
+				mesh.vertices.insert(mesh.vertices.end(), slab.vertices[m].begin(), slab.vertices[m].end());
+				mesh.quads.insert(mesh.quads.end(), slab.quads[m].begin(), slab.quads[m].end());
+			}
+		}
+	}
+
+	/*
+	 * Stores the slab local vertex index in m_cell_vertex, connectQuads adds the slab's offset.
+	 * Cell (cx, cy, cz) touches voxels cx - 1 to cx, so only the cells up to one past the bounding box are visited
+	 */
+	void MeshExtractor::placeVertices(Slab& slab)
+	{
+		for (auto& vertices : slab.vertices)
+			vertices.clear();
+
+		for (int cz = std::max(slab.begin, m_min.z); cz < std::min(slab.end, m_max.z + 2); cz++)
+		{
+			for (int cy = m_min.y; cy <= m_max.y + 1; cy++)
+			{
+				for (int cx = m_min.x; cx <= m_max.x + 1; cx++)
+				{
+					// Corner i + 2j + 4k is the voxel at (cx - 1 + i, cy - 1 + j, cz - 1 + k)
+					std::array<int, 8> meshOf;
+					for (int c = 0; c < 8; c++)
+						meshOf[c] = meshAt(cx - 1 + (c & 1), cy - 1 + ((c >> 1) & 1), cz - 1 + (c >> 2));
+
+					int* cellVertex = &m_cell_vertex[(size_t)cellIndex(cx, cy, cz) * m_meshes];
+					for (int m = 0; m < m_meshes; m++)
+					{
+						int corners = 0;
+						for (int c = 0; c < 8; c++)
+							if (meshOf[c] == m)
+								corners |= 1 << c;
+
+						if (corners == 0 || corners == 255)
+						{
+							cellVertex[m] = -1;
+							continue;
+						}
+
+						// Mean of the midpoints of the edges with one corner inside
+						glm::vec3 sum(0);
+						int crossings = 0;
+						for (int c = 0; c < 8; c++)
+						{
+							for (int axis = 1; axis < 8; axis <<= 1)
+							{
+								const int n = c | axis;
+								if ((c & axis) || ((corners >> c) & 1) == ((corners >> n) & 1))
+									continue;
+								sum += glm::vec3((c & 1) + (n & 1), ((c >> 1) & 1) + ((n >> 1) & 1), (c >> 2) + (n >> 2)) * .5f;
+								crossings++;
+							}
+						}
+						const glm::vec3 local = sum / (float)crossings;
+
+						cellVertex[m] = (int)slab.vertices[m].size();
+						slab.vertices[m].push_back(glm::vec3(m_origin) + (glm::vec3(cx - 1, cy - 1, cz - 1) + local) * (float)m_step);
+					}
+				}
+			}
+		}
+	}
+
+	/*
+	 * A slab owns the voxel pairs whose quads use its cell layers as the upper layer:
+	 * pairs along x and y in voxel layer cz - 1, which connect cell layers cz - 1 and cz,
+	 * and pairs along z between voxel layers cz - 1 and cz, which lie in cell layer cz.
+	 * A pair of two different meshes adds a quad to both, facing out of each
+	 */
+	void MeshExtractor::connectQuads(Slab& slab)
+	{
+		for (auto& quads : slab.quads)
+			quads.clear();
+
+		// m_cell_vertex holds slab local indices, the layer below may belong to the previous slab
+		auto vertexOf = [this](int mesh, int x, int y, int z)
+		{
+			const int vertex = m_cell_vertex[(size_t)cellIndex(x, y, z) * m_meshes + mesh];
+			assert(vertex >= 0);
+			return m_slabs[z / util::K_MESH_SLAB_DEPTH].offsets[mesh] + vertex;
+		};
+
+		// Counter-clockwise around +axis seen from the lower voxel's mesh, reversed for the upper one,
+		// so the quads face out of the volume
+		auto addQuads = [&](int lower, int upper, const glm::ivec3& a, const glm::ivec3& b, const glm::ivec3& c, const glm::ivec3& d)
+		{
+			if (lower >= 0)
+				slab.quads[lower].push_back(glm::ivec4(vertexOf(lower, a.x, a.y, a.z), vertexOf(lower, b.x, b.y, b.z),
+					vertexOf(lower, c.x, c.y, c.z), vertexOf(lower, d.x, d.y, d.z)));
+			if (upper >= 0)
+				slab.quads[upper].push_back(glm::ivec4(vertexOf(upper, a.x, a.y, a.z), vertexOf(upper, d.x, d.y, d.z),
+					vertexOf(upper, c.x, c.y, c.z), vertexOf(upper, b.x, b.y, b.z)));
+		};
+
+		for (int cz = std::max(slab.begin, m_min.z); cz < std::min(slab.end, m_max.z + 2); cz++)
+		{
+			const int z = cz - 1;
+			if (z >= m_min.z && z <= m_max.z)
+			{
+				for (int y = m_min.y; y <= m_max.y; y++)
+				{
+					// Pairs along x, including those with the outside of the bounding box
+					for (int x = m_min.x - 1; x <= m_max.x; x++)
+					{
+						const int lower = meshAt(x, y, z), upper = meshAt(x + 1, y, z);
+						if (lower == upper) continue;
+						// Around +x: y, then z
+						addQuads(lower, upper,
+							{ x + 1, y, z }, { x + 1, y + 1, z },
+							{ x + 1, y + 1, z + 1 }, { x + 1, y, z + 1 });
+					}
+				}
+				for (int y = m_min.y - 1; y <= m_max.y; y++)
+				{
+					// Pairs along y
+					for (int x = m_min.x; x <= m_max.x; x++)
+					{
+						const int lower = meshAt(x, y, z), upper = meshAt(x, y + 1, z);
+						if (lower == upper) continue;
+						// Around +y: z, then x
+						addQuads(lower, upper,
+							{ x, y + 1, z }, { x, y + 1, z + 1 },
+							{ x + 1, y + 1, z + 1 }, { x + 1, y + 1, z });
+					}
+				}
+			}
+
+			// Pairs along z between voxel layers cz - 1 and cz
+			for (int y = m_min.y; y <= m_max.y; y++)
+			{
+				for (int x = m_min.x; x <= m_max.x; x++)
+				{
+					const int lower = meshAt(x, y, z), upper = meshAt(x, y, z + 1);
+					if (lower == upper) continue;
+					// Around +z: x, then y
+					addQuads(lower, upper,
+						{ x, y, z + 1 }, { x + 1, y, z + 1 },
+						{ x + 1, y + 1, z + 1 }, { x, y + 1, z + 1 });
+				}
+			}
+		}
+	}
+}
\ No newline at end of file
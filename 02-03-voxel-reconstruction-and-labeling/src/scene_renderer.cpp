@@ -1,6 +1,8 @@
 #include "cvpch.h"
 #include "scene_renderer.h"
 #include "util.h"
+#include "tracer.h"
+#include "task_pool.h"
 
 namespace team45
 {
@@ -36,7 +38,8 @@ namespace team45
 		m_current_frame = 0;
 		m_previous_frame = -1;
 
-		cv::createTrackbar("Frame", util::VIDEO_WINDOW, &m_current_frame, m_number_of_frames - 2);
+		// Not bound to m_current_frame, the frames are processed on the worker thread, see Window::update
+		cv::createTrackbar("Frame", util::VIDEO_WINDOW, nullptr, m_number_of_frames - 2);
 
 		createFloorGrid();
 	}
@@ -52,10 +55,12 @@ namespace team45
 
 	/**
 	 * Process the current frame on each camera
+	 * Every camera decodes its own video, so the cameras run as separate tasks
 	 */
 	bool Scene3DRenderer::processFrame()
 	{
-		for (size_t c = 0; c < m_cameras.size(); ++c)
+		TRACE_SCOPE("processFrame");
+		TaskPool::get().parallelFor(0, (int)m_cameras.size(), 1, [this](int c)
 		{
 			if (m_current_frame == m_previous_frame + 1)
 			{
@@ -67,7 +72,7 @@ namespace team45
 			}
 			assert(m_cameras[c] != NULL);
 			m_cameras[c]->createForegroundImage();
-		}
+		});
 		return true;
 	}
 
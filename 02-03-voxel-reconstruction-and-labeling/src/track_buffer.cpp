@@ -0,0 +1,100 @@
+#include "cvpch.h"
+#include "track_buffer.h"
+
+namespace team45
+{
+	TrackBuffer::TrackBuffer() :
+		m_nVertices(0), m_Capacity(0), m_VAO(0), m_VBO(0), m_Name("")
+	{
+	}
+
+	TrackBuffer::~TrackBuffer()
+	{
+		glDeleteBuffers(1, &m_VBO);
+		glDeleteVertexArrays(1, &m_VAO);
+	}
+
+	void TrackBuffer::Create(int capacity)
+	{
+		m_Capacity = std::max(capacity, 1);
+		m_nVertices = 0;
+
+		// Generate buffers
+		glGenVertexArrays(1, &m_VAO);
+		glGenBuffers(1, &m_VBO);
+		// Bind VAO
+		glBindVertexArray(m_VAO);
+		// Bind VBO, storage only, the vertices arrive with Sync
+		glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * m_Capacity, NULL, GL_DYNAMIC_DRAW);
+		SetAttributes();
+
+		// Unbind buffers
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+	}
+
+	/**
+	 * Expects the VAO and VBO to be bound
+	 */
+	void TrackBuffer::SetAttributes() const
+	{
+		// Position (location = 0)
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Position));
+		glEnableVertexAttribArray(0);
+		// Color (location = 1)
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Color));
+		glEnableVertexAttribArray(1);
+	}
+
+	void TrackBuffer::Grow(int capacity)
+	{
+		while (m_Capacity < capacity)
+			m_Capacity *= 2;
+
+		// Copy the uploaded vertices on the GPU, so they don't have to be sent again
+		GLuint vbo;
+		glGenBuffers(1, &vbo);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(Vertex) * m_Capacity, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_COPY_READ_BUFFER, m_VBO);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(Vertex) * m_nVertices);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &m_VBO);
+		m_VBO = vbo;
+
+		// The attributes still point to the old buffer
+		glBindVertexArray(m_VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+		SetAttributes();
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+	}
+
+	void TrackBuffer::Sync(const std::vector<Vertex>& vertices)
+	{
+		const int count = (int)vertices.size();
+		if (count < m_nVertices)
+			m_nVertices = 0;
+		if (count == m_nVertices)
+			return;
+
+		if (count > m_Capacity)
+			Grow(count);
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(Vertex) * m_nVertices, sizeof(Vertex) * (count - m_nVertices), &vertices[m_nVertices]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		m_nVertices = count;
+	}
+
+	void TrackBuffer::Draw(GLenum mode) const
+	{
+		if (m_nVertices == 0)
+			return;
+		glBindVertexArray(m_VAO);
+		glDrawArrays(mode, 0, m_nVertices);
+		glBindVertexArray(0);
+	}
+}
@@ -0,0 +1,92 @@
+#include "cvpch.h"
+#include "tracker.h"
+#include "util.h"
+
+namespace team45
+{
+	void Tracker::init(int persons)
+	{
+		m_tracks.resize(persons);
+		m_misses.assign(persons, 0);
+		m_started.assign(persons, false);
+		m_predictions.assign(persons, cv::Point2f(0, 0));
+
+		// x' = x + vx, y' = y + vy, one step per frame
+		m_transition = cv::Matx44f(
+			1, 0, 1, 0,
+			0, 1, 0, 1,
+			0, 0, 1, 0,
+			0, 0, 0, 1);
+		m_process_noise = cv::Matx44f::eye() * util::K_TRACK_PROCESS_NOISE;
+		m_measurement_noise = cv::Matx22f::eye() * util::K_TRACK_MEASUREMENT_NOISE;
+	}
+
+	void Tracker::start(int person, const cv::Point2f& position)
+	{
+		Track& track = m_tracks[person];
+		track.state = cv::Vec4f(position.x, position.y, 0, 0);
+		// Sure about the position, not about the velocity
+		track.covariance = cv::Matx44f::diag(cv::Vec4f(util::K_TRACK_MEASUREMENT_NOISE, util::K_TRACK_MEASUREMENT_NOISE,
+			util::K_TRACK_INITIAL_VELOCITY_VAR, util::K_TRACK_INITIAL_VELOCITY_VAR));
+		m_misses[person] = 0;
+		m_started[person] = true;
+		m_predictions[person] = position;
+	}
+
+	const std::vector<cv::Point2f>& Tracker::predict()
+	{
+		for (int i = 0; i < m_tracks.size(); i++)
+		{
+			if (!m_started[i]) continue;
+			Track& track = m_tracks[i];
+			track.state = m_transition * track.state;
+			track.covariance = m_transition * track.covariance * m_transition.t() + m_process_noise;
+			m_predictions[i] = cv::Point2f(track.state[0], track.state[1]);
+		}
+		return m_predictions;
+	}
+
+	cv::Point2f Tracker::correct(int person, const cv::Point2f& measurement)
+	{
+		if (!m_started[person])
+		{
+			start(person, measurement);
+			return measurement;
+		}
+
+		Track& track = m_tracks[person];
+
+		// Squared Mahalanobis distance of the innovation, with S = H P H^T + R
+		// H selects the position, so H P H^T is the upper left block of P
+		const cv::Vec2f innovation(measurement.x - track.state[0], measurement.y - track.state[1]);
+		const cv::Matx22f S = track.covariance.get_minor<2, 2>(0, 0) + m_measurement_noise;
+		const cv::Matx22f inverse = S.inv();
+		const double distance = innovation.dot(inverse * innovation);
+
+		if (distance > util::K_TRACK_GATE)
+		{
+			// Most likely a mislabeled cluster, coast on the prediction
+			// Without a correction the prediction is the new state
+			if (++m_misses[person] <= util::K_TRACK_MAX_MISSES)
+				return m_predictions[person];
+
+			// The person really is somewhere else
+			DEBUG("Restarting track {} after {} gated measurements", person, m_misses[person] - 1);
+			start(person, measurement);
+			return measurement;
+		}
+
+		m_misses[person] = 0;
+
+		// Gain K = P H^T S^-1, P H^T is the left two columns of P
+		const cv::Matx42f gain = track.covariance.get_minor<4, 2>(0, 0) * inverse;
+		track.state += gain * innovation;
+		// P = (I - K H) P, K H only has its left two columns
+		cv::Matx44f KH = cv::Matx44f::zeros();
+		for (int r = 0; r < 4; r++)
+			for (int c = 0; c < 2; c++)
+				KH(r, c) = gain(r, c);
+		track.covariance = (cv::Matx44f::eye() - KH) * track.covariance;
+		return cv::Point2f(track.state[0], track.state[1]);
+	}
+}
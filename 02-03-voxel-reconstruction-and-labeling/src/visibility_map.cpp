@@ -0,0 +1,74 @@
+#include "cvpch.h"
+#include "visibility_map.h"
+#include "util.h"
+
+namespace team45
+{
+	void VisibilityMap::build(const std::vector<Voxel*>& visible, const cv::Mat& labels, int cam, const cv::Size& size)
+	{
+		// create() only allocates when the size changes, so after the first frame this is just a fill
+		// The maps are continuous, std::fill_n doesn't need the scratch buffer of setTo
+		m_depth.create(size, CV_32F);
+		m_index.create(size, CV_32S);
+		m_label.create(size, CV_32S);
+		std::fill_n(m_depth.ptr<float>(), m_depth.total(), FLT_MAX);
+		std::fill_n(m_index.ptr<int>(), m_index.total(), -1);
+		std::fill_n(m_label.ptr<int>(), m_label.total(), -1);
+
+		for (int v = 0; v < visible.size(); v++)
+		{
+			const Voxel* voxel = visible[v];
+			const cv::Point& p = voxel->pixelProjections[cam];
+			if (p.x < 0) continue;
+
+			float& depth = m_depth.at<float>(p);
+			if (voxel->distances[cam] < depth)
+			{
+				depth = voxel->distances[cam];
+				m_index.at<int>(p) = v;
+				m_label.at<int>(p) = labels.empty() ? -1 : labels.at<int>(v);
+			}
+		}
+	}
+
+	bool VisibilityMap::isOccluded(const Voxel& voxel, int cam, int label, int radius) const
+	{
+		const cv::Point& p = voxel.pixelProjections[cam];
+		const float distance = voxel.distances[cam];
+
+		const int yMin = std::max(p.y - radius, 0), yMax = std::min(p.y + radius, m_depth.rows - 1);
+		const int xMin = std::max(p.x - radius, 0), xMax = std::min(p.x + radius, m_depth.cols - 1);
+		for (int y = yMin; y <= yMax; y++)
+		{
+			const float* depth = m_depth.ptr<float>(y);
+			const int* labels = m_label.ptr<int>(y);
+			for (int x = xMin; x <= xMax; x++)
+			{
+				if (depth[x] < distance && (label < 0 || labels[x] != label))
+					return true;
+			}
+		}
+		return false;
+	}
+
+	cv::Mat VisibilityMap::drawLabels(const std::vector<cv::Scalar>& colors) const
+	{
+		cv::Mat canvas = cv::Mat::zeros(m_label.size(), CV_8UC3);
+		for (int y = 0; y < m_label.rows; y++)
+		{
+			const int* labels = m_label.ptr<int>(y);
+			for (int x = 0; x < m_label.cols; x++)
+			{
+				if (labels[x] >= 0)
+					canvas.at<cv::Vec3b>(y, x) = cv::Vec3b(
+						(uchar)colors[labels[x] % colors.size()][0],
+						(uchar)colors[labels[x] % colors.size()][1],
+						(uchar)colors[labels[x] % colors.size()][2]);
+			}
+		}
+
+		// Every voxel hits a single pixel, so grow them a bit to make the view readable
+		cv::dilate(canvas, canvas, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3)));
+		return canvas;
+	}
+}
@@ -1,16 +1,19 @@
 #include "cvpch.h"
 #include "voxel_buffer.h"
 #include "cube.h"
+#include "util.h"
 
 namespace team45
 {
 	VoxelBuffer::VoxelBuffer() :
-		m_nVertices(0), m_VAO(0), m_VBO(0), m_Name("")
+		m_nVertices(0), m_nInstances(0), m_Capacity(0), m_VAO(0), m_VBO(0), m_IVBO(0), m_Name("")
 	{
 	}
 
 	VoxelBuffer::~VoxelBuffer()
 	{
+		glDeleteBuffers(1, &m_VBO);
+		glDeleteBuffers(1, &m_IVBO);
 		glDeleteVertexArrays(1, &m_VAO);
 	}
 
@@ -19,6 +22,8 @@ namespace team45
 		auto vertices = Cube::GetVertices();
 
 		m_nVertices = vertices.size();
+		m_nInstances = 0;
+		m_Capacity = std::max(voxel_amount, 1);
 
 		// Generate buffers
 		glGenVertexArrays(1, &m_VAO);
@@ -29,23 +34,26 @@ namespace team45
 		// Bind VBO
 		glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * m_nVertices, &vertices[0], GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-		// Set attributes
+		// Set attributes, the VAO keeps them so Draw only has to bind it
 		// Vertex (location = 0)
-		/*glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(0);
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Position));
-		*/// Color (location = 1)
+		glVertexAttribDivisor(0, 0);
 
-		// Bind instance VBO
+		// Bind instance VBO, storage only, the instances arrive with Update
 		glBindBuffer(GL_ARRAY_BUFFER, m_IVBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(VoxelGPU) * voxel_amount, NULL, GL_STREAM_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(VoxelGPU) * m_Capacity, NULL, GL_STREAM_DRAW);
 
-		//glEnableVertexAttribArray(1);
-		//glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Voxel), (void*)offsetof(Voxel, color));
-		//// Offset (location = 2)
-		//glEnableVertexAttribArray(2);
-		//glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Voxel), (void*)offsetof(Voxel, position));
+		// Integer attributes, the shader reads them as uvec3 and uint
+		// Grid coordinate (location = 1)
+		glEnableVertexAttribArray(1);
+		glVertexAttribIPointer(1, 3, GL_UNSIGNED_SHORT, sizeof(VoxelGPU), (void*)offsetof(VoxelGPU, x));
+		glVertexAttribDivisor(1, 1);
+		// RGB565 color (location = 2)
+		glEnableVertexAttribArray(2);
+		glVertexAttribIPointer(2, 1, GL_UNSIGNED_SHORT, sizeof(VoxelGPU), (void*)offsetof(VoxelGPU, color));
+		glVertexAttribDivisor(2, 1);
 
 		// Unbind buffers
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -53,40 +61,60 @@ namespace team45
 		glBindVertexArray(0);
 	}
 
-	void VoxelBuffer::Draw(const std::vector<VoxelGPU>& voxels) const
+	/**
+	 * Expects the instance VBO to be bound
+	 */
+	void VoxelBuffer::Upload(const std::vector<VoxelGPU>& voxels, int begin, int end) const
 	{
-		glBindVertexArray(m_VAO);
-		glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(VoxelGPU) * begin, sizeof(VoxelGPU) * (end - begin), &voxels[begin]);
+	}
 
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Position));
-		glVertexAttribDivisor(0, 0);
+	void VoxelBuffer::Update(const std::vector<VoxelGPU>& voxels, std::vector<uint8_t>& dirty)
+	{
+		assert(dirty.size() == voxels.size());
+		const int count = (int)voxels.size();
+		m_nInstances = count;
+
+		// Collect the dirty runs, runs with a small gap between them are merged into one upload
+		m_Runs.clear();
+		int dirtyCount = 0;
+		for (int i = 0; i < count; i++)
+		{
+			if (!dirty[i]) continue;
+			dirtyCount++;
+			if (!m_Runs.empty() && i - m_Runs.back().second < util::VOXEL_UPLOAD_GAP)
+				m_Runs.back().second = i + 1;
+			else
+				m_Runs.push_back({ i, i + 1 });
+		}
+		std::fill(dirty.begin(), dirty.end(), 0);
+		if (m_Runs.empty())
+			return;
 
 		glBindBuffer(GL_ARRAY_BUFFER, m_IVBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(VoxelGPU) * voxels.size(), voxels.data(), GL_STREAM_DRAW);
-
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VoxelGPU), (void*)offsetof(VoxelGPU, color));
-		glVertexAttribDivisor(1, 1);
-
-		std::size_t vec4Size = sizeof(glm::vec4);
-
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(VoxelGPU), (void*)offsetof(VoxelGPU, model));
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(VoxelGPU), (void*)(offsetof(VoxelGPU, model) + (1 * vec4Size)));
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(VoxelGPU), (void*)(offsetof(VoxelGPU, model) + (2 * vec4Size)));
-		glEnableVertexAttribArray(5);
-		glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(VoxelGPU), (void*)(offsetof(VoxelGPU, model) + (3 * vec4Size)));
-
-		glVertexAttribDivisor(2, 1);
-		glVertexAttribDivisor(3, 1);
-		glVertexAttribDivisor(4, 1);
-		glVertexAttribDivisor(5, 1);
+		if (count > m_Capacity || dirtyCount > count / 2)
+		{
+			// Orphan the storage, so the driver doesn't have to wait for draws that still read it
+			while (m_Capacity < count)
+				m_Capacity *= 2;
+			glBufferData(GL_ARRAY_BUFFER, sizeof(VoxelGPU) * m_Capacity, NULL, GL_STREAM_DRAW);
+			Upload(voxels, 0, count);
+		}
+		else
+		{
+			for (auto& run : m_Runs)
+				Upload(voxels, run.first, run.second);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 
-		glDrawArraysInstanced(GL_TRIANGLES, 0, m_nVertices, voxels.size());
+	void VoxelBuffer::Draw() const
+	{
+		if (m_nInstances == 0)
+			return;
 
+		glBindVertexArray(m_VAO);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, m_nVertices, m_nInstances);
 		glBindVertexArray(0);
 	}
 }
\ No newline at end of file
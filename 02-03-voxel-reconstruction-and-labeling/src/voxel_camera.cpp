@@ -2,12 +2,158 @@
 #include "voxel_camera.h"
 #include "color_model.h"
 #include "util.h"
+#include "tracer.h"
+#include "memory_report.h"
+#include "task_pool.h"
 
 using namespace std;
 using namespace cv;
 
 namespace team45
 {
+	namespace
+	{
+		// A frame of the calibration video that detIntrinsics samples, and the samples without a board before it
+		struct CalibSample
+		{
+			int frame;
+			int misses;
+		};
+
+		/*
+		 * Once a board is found, or too many samples in a row had none, skip ahead,
+		 * otherwise try again 10 frames later
+		 */
+		CalibSample nextCalibSample(const CalibSample& sample, bool found, int skipStep)
+		{
+			if (found || sample.misses > util::CALIB_LOCAL_FRAMES)
+				return { sample.frame + skipStep, 0 };
+			return { sample.frame + 10, sample.misses + 1 };
+		}
+
+		/*
+		 * Decodes the calibration video on its own thread, in gray and with increased contrast.
+		 * Keeps every frame that some outcome of the pending detections can still sample,
+		 * at most window frames past the last sample with a known detection.
+		 */
+		class CalibDecoder
+		{
+		public:
+			CalibDecoder(cv::VideoCapture& video, const CalibSample& sample, int skipStep, int window) :
+				m_video(video), m_sample(sample), m_next(sample.frame), m_skip_step(skipStep), m_window(window)
+			{
+				m_thread = std::thread(&CalibDecoder::run, this);
+			}
+
+			~CalibDecoder()
+			{
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_stop = true;
+				}
+				m_cv.notify_all();
+				m_thread.join();
+			}
+
+			/*
+			 * The samples before this one are done, drop their frames
+			 */
+			void advance(const CalibSample& sample)
+			{
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_sample = sample;
+					m_frames.erase(m_frames.begin(), m_frames.lower_bound(sample.frame));
+				}
+				m_cv.notify_all();
+			}
+
+			/*
+			 * Waits until the frame is decoded, it has to be reachable from the last sample
+			 * @return False if the video ends before the frame
+			 */
+			bool get(int frame, cv::Mat& gray)
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cv.wait(lock, [&] { return m_next > frame || m_end <= frame; });
+				if (m_end <= frame)
+					return false;
+				auto it = m_frames.find(frame);
+				assert(it != m_frames.end());
+				gray = it->second;
+				return true;
+			}
+
+		private:
+			void run()
+			{
+				if (tracer::enabled())
+					tracer::setThreadName("Calibration decoder");
+
+				cv::Mat frame;
+				while (true)
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_cv.wait(lock, [this] { return m_stop || m_next < m_sample.frame + m_window; });
+					if (m_stop) return;
+					const int index = m_next;
+					const bool wanted = reachable(index);
+					lock.unlock();
+
+					// Frames no sample can land on are only grabbed, not decoded
+					const bool ok = wanted ? m_video.read(frame) : m_video.grab();
+					cv::Mat gray;
+					if (ok && wanted)
+					{
+						// Increase contrast
+						frame *= 1.20f;
+						cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+					}
+
+					lock.lock();
+					if (!ok)
+						m_end = index;
+					else if (wanted && index >= m_sample.frame)
+						m_frames[index] = gray;
+					m_next++;
+					lock.unlock();
+					m_cv.notify_all();
+					if (!ok) return;
+				}
+			}
+
+			/*
+			 * Whether some sequence of detections leads from the last sample to the frame
+			 */
+			bool reachable(int frame) const
+			{
+				std::set<std::pair<int, int>> visited;
+				std::vector<CalibSample> open = { m_sample };
+				while (!open.empty())
+				{
+					CalibSample sample = open.back();
+					open.pop_back();
+					if (sample.frame == frame) return true;
+					if (sample.frame > frame || !visited.insert({ sample.frame, sample.misses }).second) continue;
+					open.push_back(nextCalibSample(sample, true, m_skip_step));
+					open.push_back(nextCalibSample(sample, false, m_skip_step));
+				}
+				return false;
+			}
+
+			cv::VideoCapture& m_video;
+			CalibSample m_sample;						// Earliest sample whose detection is still unknown
+			int m_next;									// Next frame to decode
+			int m_end = INT_MAX;						// First frame the video doesn't have
+			const int m_skip_step, m_window;
+			std::map<int, cv::Mat> m_frames;
+			bool m_stop = false;
+			std::mutex m_mutex;
+			std::condition_variable m_cv;
+			std::thread m_thread;
+		};
+	}
+
 	vector<Point>* VoxelCamera::m_BoardCorners;  // marked checkerboard corners
 
 	VoxelCamera::VoxelCamera(const string& cdp, const int id) :
@@ -160,38 +306,87 @@ namespace team45
 		vc.read(frame);
 		cv::Size frameSize(frame.rows, frame.cols);
 
-		// When we dont find corners we try for a couple more frames
-		int notFoundCorners = 0;
-
-		while (vc.read(frame))
+		// Defining the world coordinates for 3D points
+		// We multiply our grid with the real size of the checkerboard
+		std::vector<cv::Point3f> boardPoints;
+		for (int i{ 0 }; i < m_cb_height; i++)
 		{
-			INFO("Current frame {}", vc.get(cv::CAP_PROP_POS_FRAMES));
-			// Find chessboard corners
-			std::vector<cv::Point3f> objp;
-			std::vector<cv::Point2f> imgp;
+			for (int j{ 0 }; j < m_cb_width; j++)
+				boardPoints.push_back(cv::Point3f(j * m_cb_square_size, i * m_cb_square_size, 0));
+		}
 
-			// Increase contrast
-			frame *= 1.20f;
+		// Which frame is sampled next depends on the detection in the current one.
+		// The workers detect the frames that follow if the outcome stays the same as the last one,
+		// the detections are then taken in frame order, so the samples are the ones a serial search would use.
+		const int skipStep = std::max(skipFrames, 0) + 1;
+		const int window = std::max(util::CALIB_DECODE_WINDOW, 2 * std::max(skipStep, 10));
+		const size_t lookahead = 2 * (TaskPool::get().workers() + 1);
 
-			bool success = findCbCorners(frame, objp, imgp);
-			if (success)
+		struct Detection
+		{
+			bool found = false;
+			std::vector<cv::Point2f> corners;
+		};
+		std::map<int, Detection> detections;
+		std::vector<int> frames;
+		std::vector<cv::Mat> grays;
+		std::vector<Detection> results;
+
+		CalibSample sample{ 1, 0 };
+		bool lastFound = true;
+		CalibDecoder decoder(vc, sample, skipStep, window);
+		auto start = std::chrono::steady_clock::now();
+		size_t searched = 0;
+		while (true)
+		{
+			for (auto it = detections.find(sample.frame); it != detections.end(); it = detections.find(sample.frame))
 			{
-				objPoints.push_back(objp);
-				imgPoints.push_back(imgp);
+				INFO("Current frame {}", sample.frame + 1);
+				if (it->second.found)
+				{
+					objPoints.push_back(boardPoints);
+					imgPoints.push_back(it->second.corners);
+				}
+				lastFound = it->second.found;
+				sample = nextCalibSample(sample, lastFound, skipStep);
 			}
-			if (success || notFoundCorners++ > util::CALIB_LOCAL_FRAMES)
+			decoder.advance(sample);
+			detections.erase(detections.begin(), detections.lower_bound(sample.frame));
+
+			frames.clear();
+			grays.clear();
+			CalibSample guess = sample;
+			while (frames.size() < lookahead && guess.frame < sample.frame + window)
 			{
-				// Skip an amount of frames
-				for (int i = 0; i < skipFrames; i++)
-					vc.grab();
-				notFoundCorners = 0;
-				continue;
+				bool found = lastFound;
+				auto known = detections.find(guess.frame);
+				if (known != detections.end())
+				{
+					found = known->second.found;
+				}
+				else
+				{
+					cv::Mat gray;
+					if (!decoder.get(guess.frame, gray)) break;
+					frames.push_back(guess.frame);
+					grays.push_back(gray);
+				}
+				guess = nextCalibSample(guess, found, skipStep);
 			}
+			// The next sample lies past the end of the video
+			if (frames.empty()) break;
 
-			// Skip an amount of frames
-			for (int i = 0; i < 9; i++)
-				vc.grab();
+			results.assign(frames.size(), Detection());
+			TaskPool::get().parallelFor(0, (int)frames.size(), 1, [&](int i)
+			{
+				results[i].found = findCbCorners(grays[i], results[i].corners);
+			});
+			for (size_t i = 0; i < frames.size(); i++)
+				detections[frames[i]] = std::move(results[i]);
+			searched += frames.size();
 		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		INFO("Searched {} frames for the checkerboard in {:.2f}s, {:.1f} frames/s", searched, seconds, searched / std::max(seconds, 1e-9));
 		INFO("Detected a total of {} images with checkerboard", objPoints.size());
 
 		double finalError = cv::calibrateCamera(objPoints, imgPoints, frameSize, m_intrinsic, m_dist_coeffs, m_R, m_T);
@@ -208,44 +403,43 @@ namespace team45
 		return true;
 	}
 
-	bool VoxelCamera::findCbCorners(cv::Mat& frame, std::vector<cv::Point3f>& objPoints, std::vector<cv::Point2f>& imgPoints)
+	bool VoxelCamera::findCbCorners(const cv::Mat& gray, std::vector<cv::Point2f>& imgPoints) const
 	{
 		INFO("Finding chessboard corners");
-		cv::Mat gray;
-		cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
 
 		// Finding checker board corners
 		// If desired number of corners are found in the image then success = true  
-		bool success = cv::findChessboardCorners(gray, cv::Size(m_cb_width, m_cb_height), imgPoints, cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_FAST_CHECK | cv::CALIB_CB_NORMALIZE_IMAGE);
+		// Frames without a board are rejected on the small level, at a fraction of the cost.
+		// Keep it off for boards with squares of a few pixels, they are lost when downscaled.
+		cv::Mat level = gray;
+		int scale = 1;
+		while (util::CALIB_PYRAMID_WIDTH > 0 && level.cols / 2 >= util::CALIB_PYRAMID_WIDTH)
+		{
+			cv::Mat smaller;
+			cv::pyrDown(level, smaller);
+			level = smaller;
+			scale *= 2;
+		}
+
+		bool success = cv::findChessboardCorners(level, cv::Size(m_cb_width, m_cb_height), imgPoints, cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_FAST_CHECK | cv::CALIB_CB_NORMALIZE_IMAGE);
 
 		/*
 			* If desired number of corner are detected,
-			* we refine the pixel coordinates and display
-			* them on the images of checker board
+			* we refine the pixel coordinates at full resolution
 		*/
 		if (success)
 		{
 			INFO("Found!");
 			cv::TermCriteria criteria(cv::TermCriteria::EPS | cv::TermCriteria::MAX_ITER, 30, 0.001);
 
+			// Pixel x of the level is pixel (x + 0.5) * scale - 0.5 at full resolution, a level pixel covers scale pixels
+			for (auto& point : imgPoints)
+				point = (point + cv::Point2f(.5f, .5f)) * (float)scale - cv::Point2f(.5f, .5f);
+
 			// refining pixel coordinates for given 2d points.
 			cv::cornerSubPix(gray, imgPoints, cv::Size(7, 7), cv::Size(-1, -1), criteria);
-
-			// Defining the world coordinates for 3D points
-			// We multiply our grid with the real size of the checkerboard
-			for (int i{ 0 }; i < m_cb_height; i++)
-			{
-				for (int j{ 0 }; j < m_cb_width; j++)
-					objPoints.push_back(cv::Point3f(j * m_cb_square_size, i * m_cb_square_size, 0));
-			}
-
-		cv:drawChessboardCorners(frame, cv::Size(m_cb_width, m_cb_height), imgPoints, true);
 		}
 
-		/*cv::imshow("CB Corner Display", frame);
-		cv::waitKey(0);
-		cv::destroyWindow("CB Corner Display");*/
-
 		return success;
 	}
 
@@ -255,8 +449,11 @@ namespace team45
 	*/
 	void VoxelCamera::initBgModel()
 	{
+		TRACE_SCOPE_ARG("initBgModel", m_id);
 		INFO("Initialize background model");
 		m_bg_model = cv::createBackgroundSubtractorMOG2();
+		// 5x5 morphological kernel, representing a cross
+		m_morph_kernel = cv::getStructuringElement(cv::MORPH_CROSS, cv::Size(5, 5));
 		std::string bg_video_path = m_data_path + util::BACKGROUND_VIDEO;
 
 		assert(util::fexists(bg_video_path));
@@ -283,7 +480,14 @@ namespace team45
 		m_histograms = color_models;
 	}
 
-	bool VoxelCamera::loadColorModels(std::vector<cv::Point3f>& bins)
+	void VoxelCamera::clearColorModels()
+	{
+		for (auto& p : m_histograms)
+			delete p;
+		m_histograms.clear();
+	}
+
+	bool VoxelCamera::loadColorModels(std::shared_ptr<const ColorBins> bins)
 	{
 		cv::FileStorage fs(m_data_path + util::COLOR_MODELS, cv::FileStorage::READ);
 		if (fs.isOpened())
@@ -689,29 +893,41 @@ namespace team45
 		return projectOnView(coords, m_rotation_values, m_translation_values, m_camera_matrix, m_distortion_coeffs);
 	}
 
-	void VoxelCamera::createForegroundImage()
+	void VoxelCamera::reportMemory(MemoryReport& report) const
 	{
-		cv::Mat blurred, tmp, tmpMask, foreground_mask;
-		//cv::GaussianBlur(getFrame(), blurred, Size(3, 3), 1, 1);
-		m_bg_model->apply(m_frame, tmpMask, 0);
-		cv::threshold(tmpMask, tmpMask, 200, 255, cv::THRESH_BINARY);
+		std::string name = "Camera " + std::to_string(m_id + 1) + " ";
+		report.add(name + "frames", MemoryReport::bytes(m_frame) + MemoryReport::bytes(m_foreground_image) + MemoryReport::bytes(m_binary_diff)
+			+ MemoryReport::bytes(m_previous_foreground) + MemoryReport::bytes(m_bg_mask) + MemoryReport::bytes(m_eroded_mask));
+
+		size_t histograms = MemoryReport::bytes(m_histograms);
+		for (auto h : m_histograms)
+			histograms += h->memoryUsage();
+		report.add(name + "color models", histograms);
+	}
 
-		// 3x3 morphological kernel, representing a cross 
-		cv::Mat kernel = cv::getStructuringElement(cv::MORPH_CROSS, cv::Size(5, 5));
+	/*
+		The masks are members, so after the first two frames every step writes into the buffers of the frame before
+	*/
+	void VoxelCamera::createForegroundImage()
+	{
+		TRACE_SCOPE_ARG("createForegroundImage", m_id);
+		m_bg_model->apply(m_frame, m_bg_mask, 0);
+		cv::threshold(m_bg_mask, m_bg_mask, 200, 255, cv::THRESH_BINARY);
 
-		cv::erode(tmpMask, tmp, kernel);
-		cv::dilate(tmp, foreground_mask, kernel);
+		cv::erode(m_bg_mask, m_eroded_mask, m_morph_kernel);
+		// The previous foreground image is still needed for the difference, so the new one goes into the other buffer
+		cv::dilate(m_eroded_mask, m_previous_foreground, m_morph_kernel);
+		cv::swap(m_foreground_image, m_previous_foreground);
 
 		// Determine binary difference between current frames binary mask and previous frame binary mask
-		if (m_foreground_image.rows != 0)
+		if (m_previous_foreground.rows != 0)
 		{
-			cv::bitwise_xor(foreground_mask, m_foreground_image, m_binary_diff);
+			cv::bitwise_xor(m_foreground_image, m_previous_foreground, m_binary_diff);
 		}
 		else
 		{
-			m_binary_diff = foreground_mask;
+			m_foreground_image.copyTo(m_binary_diff);
 		}
-		m_foreground_image = foreground_mask;
 	}
 
 } /* namespace team45 */
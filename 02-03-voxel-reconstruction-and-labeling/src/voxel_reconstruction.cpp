@@ -3,6 +3,12 @@
 #include "voxel_reconstruction.h"
 #include "voxel_camera.h"
 #include "color_model.h"
+#include "tracer.h"
+#include "memory_report.h"
+#include "hungarian.h"
+#include "kmeans.h"
+#include "task_pool.h"
+#include "alloc_counter.h"
 
 using namespace std;
 using namespace cv;
@@ -14,7 +20,8 @@ namespace team45
 	 * Voxel reconstruction class
 	 */
 	VoxelReconstruction::VoxelReconstruction(const vector<VoxelCamera*>& cs, int height, int step) :
-		m_cameras(cs), m_height(height), m_step(step), m_permutations(util::permutations(util::K_NR_OF_PERSONS))
+		m_cameras(cs), m_height(height), m_step(step),
+		m_arena_buffer(util::K_FRAME_ARENA_BYTES), m_frame_arena(m_arena_buffer.data(), m_arena_buffer.size())
 	{
 		for (size_t c = 0; c < m_cameras.size(); ++c)
 		{
@@ -24,17 +31,33 @@ namespace team45
 				m_plane_size = m_cameras[c]->getSize();
 		}
 
+		if (m_cameras.size() > MAX_CAMERAS)
+			WARN("Voxels are colored from the first {} of {} cameras", MAX_CAMERAS, m_cameras.size());
+
 		const size_t edge = 2 * m_height;
 		m_voxels_amount = (edge / m_step) * (edge / m_step) * (m_height / m_step);
 
 		m_toggle_camera.resize(cs.size());
 
 		m_2d_tracking.resize(util::K_NR_OF_PERSONS);
+		// One position per person per frame, so tracking never has to grow during playback
+		for (auto& track : m_2d_tracking)
+			track.reserve(m_cameras.front()->getFramesAmount());
+		m_assignment.resize(util::K_NR_OF_PERSONS);
+		std::iota(m_assignment.begin(), m_assignment.end(), 0);
+		m_tracker.init(util::K_NR_OF_PERSONS);
+		m_track_records.resize(util::K_NR_OF_PERSONS);
+		m_track_log.open(util::DATA_DIR_STR + util::TRACK_LOG, util::K_NR_OF_PERSONS, util::TRACK_LOG_INDEX_INTERVAL);
 
 		initVoxels(-300, 700);
+		reserveFrameBuffers();
+		m_mesh_extractor.init(m_origin, m_dimensions, m_step, util::MESH_PER_PERSON ? util::K_NR_OF_PERSONS : 1);
+		m_ply_writer.start();
 
 		initBins();
 		initColorModels();
+
+		logMemory();
 	}
 
 	/**
@@ -57,6 +80,7 @@ namespace team45
 	 */
 	void VoxelReconstruction::initVoxels(int offsetX, int offsetY)
 	{
+		TRACE_SCOPE("initVoxels");
 		// Cube dimensions from [(-m_height, m_height), (-m_height, m_height), (0, m_height)]
 		const int xL = -m_height + offsetX;
 		const int xR = m_height + offsetX;
@@ -69,6 +93,12 @@ namespace team45
 		const int plane_x = (xR - xL) / m_step;
 		const int plane = plane_y * plane_x;
 
+		m_origin = glm::ivec3(xL, yL, zL);
+		m_dimensions = glm::ivec3(plane_x, plane_y, (zR - zL) / m_step);
+		// VoxelGPU stores the grid coordinate in 16 bits
+		assert(m_dimensions.x <= UINT16_MAX && m_dimensions.y <= UINT16_MAX && m_dimensions.z <= UINT16_MAX);
+		m_floor_grid.init(cv::Point(xL, yL), cv::Size(plane_x, plane_y), m_step);
+
 		// Save the 8 volume corners
 		// bottom
 		m_corners.push_back(new Point3f((float)xL, (float)yL, (float)zL));
@@ -88,6 +118,7 @@ namespace team45
 
 		// Initialize lookup table
 		m_lookup.resize(m_cameras.size());
+		m_visibility.resize(m_cameras.size());
 
 		// Prepare our flag that determines if a voxel is on in all cameras
 		// 00.....01111
@@ -102,20 +133,25 @@ namespace team45
 			cameraPositions.push_back(pos);
 		}
 
-		int z;
 		int pdone = 0;
 		std::vector<int> camCount{ 0,0,0,0 };
-#pragma omp parallel for schedule(static) private(z) shared(pdone, camCount)
-		for (z = zL; z < zR; z += m_step)
+		std::mutex progress_mutex;
+		std::vector<std::mutex> lookup_mutexes(m_cameras.size());
+		const int slices = (zR - zL + m_step - 1) / m_step;
+		TaskPool::get().parallelFor(0, slices, 1, [&](int zp)
 		{
-			const int zp = (z - zL) / m_step;
+			// One event per slice, so the trace shows how the slices are spread over the workers
+			TRACE_SCOPE_ARG("initVoxels slice", zp);
+			const int z = zL + zp * m_step;
 			int done = cvRound((zp * plane / (double)m_voxels_amount) * 100.0);
 
-#pragma omp critical
-			if (done > pdone)
 			{
-				pdone = done;
-				cout << done << "%..." << flush;
+				std::lock_guard<std::mutex> lock(progress_mutex);
+				if (done > pdone)
+				{
+					pdone = done;
+					cout << done << "%..." << flush;
+				}
 			}
 
 			int y, x;
@@ -130,8 +166,10 @@ namespace team45
 					// Create all voxels
 					Voxel* voxel = new Voxel;
 					voxel->visibleIndex = -1;
+					voxel->surfaceIndex = -1;
 					voxel->position = glm::ivec3(x, y, z);
 					voxel->camera_flags = 0;
+					voxel->color_cameras = -1;
 					voxel->color = glm::vec3(0);
 
 					const int p = zp * plane + yp * plane_x + xp;  // The voxel's index
@@ -160,8 +198,8 @@ namespace team45
 							continue;
 						}
 
-#pragma omp critical
 						{
+							std::lock_guard<std::mutex> lock(lookup_mutexes[c]);
 							// Calculate pixel index in the lookup table  
 							int absPos = point.y * m_cameras[c]->getSize().width + point.x;
 							auto iterator = m_lookup[c].find(absPos);
@@ -181,9 +219,10 @@ namespace team45
 					m_voxels[p] = voxel;
 				}
 			}
-		}
+		});
 
 		// Sort each vector so that the voxel closest to the pixel is in front
+		TRACE_SCOPE("initVoxels sort");
 		for (int c = 0; c < m_cameras.size(); c++)
 		{
 			for (auto it = m_lookup[c].begin(); it != m_lookup[c].end(); it++)
@@ -199,6 +238,30 @@ namespace team45
 
 	}
 
+	/*
+		A voxel can only turn on when every camera sees it, so those voxels bound the buffers that grow with the visible voxels.
+		Reserved up front, a frame with more voxels than any before doesn't have to grow them either.
+		Only m_changed_voxels can go beyond, when voxels turn off and on again within one frame.
+	*/
+	void VoxelReconstruction::reserveFrameBuffers()
+	{
+		size_t seen = 0;
+		for (Voxel* voxel : m_voxels)
+			seen += std::all_of(voxel->pixelProjections.begin(), voxel->pixelProjections.end(),
+				[](const cv::Point& p) { return p.x >= 0; });
+
+		m_visible_voxels.reserve(seen);
+		m_changed_voxels.reserve(seen);
+		m_surface_voxels.reserve(seen);
+		m_surface_voxels_gpu.reserve(seen);
+		m_surface_voxels_dirty.reserve(seen);
+		m_voxel_points.reserve(seen);
+		m_label_buffer.reserve(seen);
+		m_seed_distances.reserve(seen);
+		m_best_labels.reserve(seen);
+		INFO("{} of {} voxels are seen by every camera", seen, m_voxels.size());
+	}
+
 	/*
 		Initializes the bins (colors) that our Histograms (Color Models) will use.
 		We do this by clustering the pixels in the foreground image
@@ -207,140 +270,292 @@ namespace team45
 	*/
 	void VoxelReconstruction::initBins()
 	{
+		TRACE_SCOPE("initBins");
 		INFO("Initializing bins");
 		std::string path = util::DATA_DIR_STR + "4persons/" + util::BINS;
 		cv::FileStorage fs(path, cv::FileStorage::READ);
+		std::vector<cv::Point3f> bins;
 		if (fs.isOpened())
 		{
-			fs["Bins"] >> m_bins;
+			fs["Bins"] >> bins;
+			m_bins = std::make_shared<ColorBins>(bins);
 			return;
 		}
 
 		// No file found,
-		// So determine bins for our histogram
-		// We choose camera 1 (front view) to create our bins
-		m_cameras[1]->setVideoFrame(m_cameras[1]->getFrameAllVisible());
-		m_cameras[1]->createForegroundImage();
-		auto& tempFrame = m_cameras[1]->getFrame();
-
-		cv::Mat frame;
-		tempFrame.convertTo(frame, CV_32F);
-		m_cameras[1]->reloadVideo();
-
-		// Get mask
-		cv::Mat mask = m_cameras[1]->getForegroundImage();
-		//INFO("mask dims {} {}", mask.size().width, mask.size().height);
-		//cv::line(mask, { 0, 275 }, { 600, 275 }, util::COLOR_RED, 2);
-		//cv::imshow("Mask", mask);
-		//cv::waitKey();
-		std::vector<cv::Point3f> pixels;
-		// We start from 275 to cut off the legs
-		for (int y = 0; y < frame.rows; y++)
+		// So determine bins for our histogram from the foreground pixels of several frames of all cameras.
+		// Every camera keeps a uniform sample (reservoir) of its pixels, so memory is fixed however long the footage is
+		const int cams = (int)m_cameras.size();
+		const int capacity = util::K_BINS_SAMPLES / cams;
+		std::vector<std::vector<cv::Point3f>> reservoirs(cams);
+
+		TaskPool::get().parallelFor(0, cams, 1, [&](int c)
 		{
-			for (int x = 0; x < frame.cols; x++)
-				if (mask.at<uchar>(y, x) != 0)
+			std::vector<cv::Point3f>& reservoir = reservoirs[c];
+			reservoir.reserve(capacity);
+			std::mt19937 rng(c);
+			long seen = 0;
+
+			for (int f = 0; f < util::K_BINS_FRAMES; f++)
+			{
+				m_cameras[c]->setVideoFrame((int)((m_cameras[c]->getFramesAmount() - 2) * (f + .5) / util::K_BINS_FRAMES));
+				m_cameras[c]->createForegroundImage();
+				const cv::Mat& frame = m_cameras[c]->getFrame();
+				const cv::Mat& mask = m_cameras[c]->getForegroundImage();
+
+				for (int y = 0; y < frame.rows; y++)
 				{
-					pixels.push_back(frame.at<cv::Point3f>(y, x));
+					const cv::Vec3b* row = frame.ptr<cv::Vec3b>(y);
+					const uchar* masked = mask.ptr<uchar>(y);
+					for (int x = 0; x < frame.cols; x++)
+					{
+						if (masked[x] == 0) continue;
+
+						// Algorithm R: the n-th pixel replaces a random sample with probability capacity / n
+						cv::Point3f pixel(row[x][0], row[x][1], row[x][2]);
+						if (reservoir.size() < capacity)
+							reservoir.push_back(pixel);
+						else
+						{
+							long r = std::uniform_int_distribution<long>(0, seen)(rng);
+							if (r < capacity)
+								reservoir[r] = pixel;
+						}
+						seen++;
+					}
 				}
+			}
+			m_cameras[c]->reloadVideo();
+		});
+
+		std::vector<cv::Point3f> pixels;
+		for (auto& reservoir : reservoirs)
+			pixels.insert(pixels.end(), reservoir.begin(), reservoir.end());
+		INFO("Sampled {} foreground pixels from {} frames per camera", pixels.size(), util::K_BINS_FRAMES);
+
+		// Without foreground there are no colors to cluster, so fall back to a gray ramp and don't save it
+		if (pixels.size() < util::K_NR_OF_BINS)
+		{
+			ERROR("Sampled {} foreground pixels but need {} for the bins, using gray bins", pixels.size(), util::K_NR_OF_BINS);
+			for (int i = 0; i < util::K_NR_OF_BINS; i++)
+			{
+				float gray = 255.f * (i + .5f) / util::K_NR_OF_BINS;
+				bins.push_back(cv::Point3f(gray, gray, gray));
+			}
+			m_bins = std::make_shared<ColorBins>(bins);
+			return;
 		}
 
-		// Determine most prominent colors in the view
-		TermCriteria criteria(cv::TermCriteria::EPS, 0, 1);
-		int flags = cv::KMEANS_PP_CENTERS;
-		cv::Mat labels;
-		cv::kmeans(pixels, 9, labels, criteria, 3, flags, m_bins);
+		// Determine most prominent colors in the views
+		bins = util::miniBatchKmeans(pixels, util::K_NR_OF_BINS, util::K_BINS_BATCH_SIZE, util::K_BINS_ITERATIONS, 0);
+		m_bins = std::make_shared<ColorBins>(bins);
 
 		fs = cv::FileStorage(path, cv::FileStorage::WRITE);
-		fs << "Bins" << m_bins;
+		fs << "Bins" << bins;
 	}
 
 	void VoxelReconstruction::initColorModels()
 	{
+		TRACE_SCOPE("initColorModels");
 		INFO("Initializing color models");
 
+		// The models every frame is matched with are reused, only their counts change
+		const int persons = util::K_NR_OF_PERSONS;
+		m_frame_models.assign(m_cameras.size(), std::vector<Histogram>(persons, Histogram(m_bins)));
+		m_frame_model_order.assign(m_cameras.size(), std::vector<Histogram*>(persons));
+		m_partial_models.assign(m_cameras.size(), std::vector<std::vector<Histogram>>(
+			util::K_COLOR_MODEL_CHUNKS, std::vector<Histogram>(persons, Histogram(m_bins))));
+
 		// Initialize the color models for each camera!
+		std::string loaded, missing;
 		for (int c = 0; c < m_cameras.size(); c++)
 		{
-			if (!m_cameras[c]->loadColorModels(m_bins))
-			{
-				// We need to create a new color model and save it
-				int frameNr = m_cameras[c]->getFrameAllVisible();
-				for (int i = 0; i < m_cameras.size(); i++)
-				{
-					// Set it to the current frame
-					// Create a foreground mask
-					m_cameras[i]->setVideoFrame(frameNr);
-					m_cameras[i]->createForegroundImage();
-				}
+			if (m_cameras[c]->loadColorModels(m_bins))
+				loaded += (loaded.empty() ? "" : ", ") + std::to_string(m_cameras[c]->getId());
+			else
+				missing += (missing.empty() ? "" : ", ") + std::to_string(m_cameras[c]->getId());
+		}
+		if (missing.empty())
+			return;
 
-				// Update and label the voxels
-				updateVoxels();
-				labelVoxels();
+		if (!util::COLOR_MODEL_BOOTSTRAP)
+		{
+			for (int c = 0; c < m_cameras.size(); c++)
+				if (m_cameras[c]->getColorModels().empty())
+					createColorModelsByHand(c);
+			return;
+		}
 
-				// Create the models and save them 
+		// The person ids have to agree between the cameras, so a missing model means building all of them
+		if (!loaded.empty())
+			WARN("No color models for camera {}, replacing the existing models of camera {}", missing, loaded);
+		bootstrapColorModels();
+	}
 
-				std::vector<Histogram*> models;
-				createColorModels(c, models);
-				m_cameras[c]->setColorModels(models);
+	/*
+		Build and save the color models of a camera from the FrameAllVisible frame.
+		The models are drawn so their person ids can be synced with the other cameras by hand.
+	*/
+	void VoxelReconstruction::createColorModelsByHand(int cam)
+	{
+		labelFrame(m_cameras[cam]->getFrameAllVisible());
 
-				// Now we have to make sure that each model refers to the same person!
-				// We first tryied this by comparing all different permutations of each color model from a camera with the first camera
-				// Because the coloring didn't go well we did "synced" the color models of each camera by hand
+		// The camera keeps its offline models, so give it copies of the frame models
+		createColorModels(cam);
+		std::vector<Histogram*> models;
+		for (auto& model : m_frame_models[cam])
+			models.push_back(new Histogram(model));
 
-				auto m = m_cameras[c]->getColorModels();
+		// Now we have to make sure that each model refers to the same person!
+		// Because the coloring didn't go well we "synced" the color models of each camera by hand
+		for (int i = 0; i < models.size(); i++)
+		{
+			models[i]->setId(i);
+			models[i]->draw();
+		}
+		m_cameras[cam]->saveColorModels(models);
+		waitKey();
 
-				for (int i = 0; i < m.size(); i++)
-				{
-					m[i]->setId(i);
-					m[i]->draw();
-				}
-				m_cameras[c]->saveColorModels(m);
-				waitKey();
+		// Reload the video from all the cams because of some weird issue with video.set?
+		for (int c = 0; c < m_cameras.size(); c++)
+			m_cameras[c]->reloadVideo();
+	}
 
-				// Reload the video from all the cams because of some weird issue with video.set?
-				for (int i = 0; i < m_cameras.size(); i++)
-					m_cameras[i]->reloadVideo();
-			}
+	/*
+		Label the voxels of a frame from scratch (k-means++ restart)
+	*/
+	void VoxelReconstruction::labelFrame(int frameNr)
+	{
+		for (int c = 0; c < m_cameras.size(); c++)
+		{
+			// Set it to the current frame
+			// Create a foreground mask
+			m_cameras[c]->setVideoFrame(frameNr);
+			m_cameras[c]->createForegroundImage();
 		}
+
+		ClusterMode mode = m_cluster_mode;
+		m_cluster_mode = ClusterMode::Restart;
+		updateVoxels();
+		labelVoxels();
+		updateVisibility();
+		m_cluster_mode = mode;
 	}
 
 	/*
-		Changes m2, so that each model (person) in m2 matches the correct model in m1.
-		So m1 already knows which model is which person, and m2 uses the correlation between the models to estimate it's own matches
+		Build and save the color models of all cameras without user input.
+		The frames in which the persons are separated best are labeled once for all cameras,
+		so the models of every camera come from the same 3D clusters and share their person ids.
+		The first frame defines the ids, later frames are matched to the models so far like any other frame.
 	*/
-	float VoxelReconstruction::matchModels(std::vector<Histogram*>& m1, std::vector<Histogram*>& m2, int& outPermutation)
+	void VoxelReconstruction::bootstrapColorModels()
 	{
-		// Scores for each permutation
-		std::vector<float> scores;
+		TRACE_SCOPE("bootstrapColorModels");
+		INFO("Creating color models from {} frames", util::K_BOOTSTRAP_FRAMES);
+		const int persons = util::K_NR_OF_PERSONS;
+
+		// Score evenly spaced frames (and the configured one) on how far apart the clusters are, relative to their size
+		std::vector<int> candidates;
+		for (int i = 0; i < util::K_BOOTSTRAP_CANDIDATES; i++)
+			candidates.push_back((int)((m_cameras.front()->getFramesAmount() - 2) * (i + .5) / util::K_BOOTSTRAP_CANDIDATES));
+		candidates.push_back(m_cameras.front()->getFrameAllVisible());
+
+		std::vector<std::pair<double, int>> scores;
+		for (int frameNr : candidates)
+		{
+			labelFrame(frameNr);
+			if (m_estimated_persons != persons || m_visible_voxels.size() < persons)
+				continue;
+
+			double closest = DBL_MAX;
+			for (int a = 0; a < persons; a++)
+				for (int b = a + 1; b < persons; b++)
+					closest = std::min(closest, cv::norm(m_cluster_centers.row(a) - m_cluster_centers.row(b)));
+			scores.push_back({ closest / std::sqrt(m_reference_compactness), frameNr });
+		}
 
-		// Per permutation compare models
-		for (int p = 0; p < m_permutations.size(); p++)
+		if (scores.empty())
 		{
-			std::vector<int> permutation = m_permutations[p];
-			float score = 0;
+			WARN("No frame with {} separate persons found, using frame {}", persons, candidates.back());
+			scores.push_back({ 0, candidates.back() });
+		}
+		std::sort(scores.begin(), scores.end(), std::greater<>());
+		scores.resize(std::min((int)scores.size(), util::K_BOOTSTRAP_FRAMES));
 
-			for (int i = 0; i < m1.size(); i++)
+		// Raw sums of the frame models per camera, per person
+		std::vector<std::vector<Histogram>> sums(m_cameras.size(), std::vector<Histogram>(persons, Histogram(m_bins)));
+		for (int c = 0; c < m_cameras.size(); c++)
+		{
+			m_cameras[c]->clearColorModels();
+			std::vector<Histogram*> models;
+			for (int i = 0; i < persons; i++)
+				models.push_back(new Histogram(m_bins));
+			m_cameras[c]->setColorModels(models);
+		}
+
+		for (int f = 0; f < scores.size(); f++)
+		{
+			DEBUG("Color models from frame {} (separation {})", scores[f].second, scores[f].first);
+			labelFrame(scores[f].second);
+			m_frame_arena.release();
+
+			// The clusters of the first frame are the persons, after that the cameras vote on the assignment
+			std::vector<int> assignment(persons);
+			if (f == 0)
 			{
-				score += m1[i]->compare(*m2[permutation[i]]);
+				TaskPool::get().parallelFor(0, (int)m_cameras.size(), 1, [this](int cam) { createColorModels(cam); });
+				std::iota(assignment.begin(), assignment.end(), 0);
+			}
+			else
+			{
+				assignment = matchClusters();
 			}
-			scores.push_back(score);
-		}
 
-		// Find the best score, which is the lowest distance
-		int index = 0;
-		float best = FLT_MAX;
-		for (int s = 0; s < scores.size(); s++)
-			if (scores[s] < best)
+			for (int c = 0; c < m_cameras.size(); c++)
 			{
-				best = scores[s];
-				index = s;
+				std::vector<Histogram*>& models = m_cameras[c]->getColorModels();
+				for (int i = 0; i < persons; i++)
+				{
+					sums[c][i].merge(m_frame_models[c][assignment[i]]);
+					*models[i] = sums[c][i];
+					models[i]->normalize();
+					models[i]->setId(i);
+				}
 			}
+		}
 
-		// Use the index to set the id's
-		std::vector<int> bestPermutation = m_permutations[index];
-		//INFO("Permutation: {} {} {} {}", bestPermutation[0], bestPermutation[1], bestPermutation[2], bestPermutation[3]);
-		for (int i = 0; i < bestPermutation.size(); i++)
-			m2[i]->setId(bestPermutation[i]);
+		for (int c = 0; c < m_cameras.size(); c++)
+			m_cameras[c]->saveColorModels(m_cameras[c]->getColorModels());
+
+		// Reload the video from all the cams because of some weird issue with video.set?
+		for (int c = 0; c < m_cameras.size(); c++)
+			m_cameras[c]->reloadVideo();
+		INFO("Saved color models of {} cameras", m_cameras.size());
+	}
+
+	/*
+		Changes m2, so that each model (person) in m2 matches the correct model in m1.
+		So m1 already knows which model is which person, and m2 uses the correlation between the models to estimate it's own matches
+	*/
+	float VoxelReconstruction::matchModels(std::vector<Histogram*>& m1, std::vector<Histogram*>& m2, std::pmr::vector<int>& outAssignment)
+	{
+		// Only K^2 distinct comparisons exist, so compute them once
+		// The rows take the arena from the outer vector
+		std::pmr::vector<std::pmr::vector<float>> cost(m1.size(), &m_frame_arena);
+		for (int i = 0; i < m1.size(); i++)
+		{
+			cost[i].resize(m2.size());
+			for (int j = 0; j < m2.size(); j++)
+				cost[i][j] = m1[i]->compare(*m2[j]);
+		}
+
+		// Find the assignment with the lowest total distance, person i gets cluster outAssignment[i]
+		float best;
+		util::hungarian(cost, outAssignment, best, &m_frame_arena);
+
+		// Use the assignment to set the id's
+		for (int i = 0; i < outAssignment.size(); i++)
+			m2[outAssignment[i]]->setId(i);
 
 		// Sort on id
 		std::sort(m2.begin(), m2.end(),
@@ -348,28 +563,52 @@ namespace team45
 				return a->getId() < b->getId();
 			});
 
-		for (int i = 0; i < util::K_NR_OF_PERSONS; i++)
-		{
-			//m1[i]->draw();
-			//m2[i]->draw();
-			//cv::waitKey();
-		}
-
-		outPermutation = index;
 		return best;
-
 	}
 
 	/**
 	 * The order of operations matters
 	 */
-	void VoxelReconstruction::update()
+	void VoxelReconstruction::update(int frameNr)
 	{
+		TRACE_SCOPE("update");
+		m_frame_nr = frameNr;
+		// Everything allocated from the arena during the previous frame is dropped at once
+		m_frame_arena.release();
+		// Only counts this thread, the tasks that run on the pool's workers are not checked
+		const size_t allocations = alloc_counter::count();
+
+		// The tracks predict where every person is now, which is where the clustering starts from
+		const std::vector<cv::Point2f>& predictions = m_tracker.predict();
+		if (m_tracker.isStarted() && m_cluster_centers.rows == util::K_NR_OF_PERSONS)
+		{
+			for (int i = 0; i < util::K_NR_OF_PERSONS; i++)
+			{
+				m_cluster_centers.at<float>(m_assignment[i], 0) = predictions[i].x;
+				m_cluster_centers.at<float>(m_assignment[i], 1) = predictions[i].y;
+			}
+		}
+
 		updateVoxels();
 		labelVoxels();
-		int permutation = matchClusters();
-		trackClusters(permutation);
-		colorVoxels(permutation);
+		updateVisibility();
+
+		// Without a center per person there is nothing to match or track, the tracks coast on their predictions
+		if (m_visible_voxels.size() >= util::K_NR_OF_PERSONS && m_cluster_centers.rows == util::K_NR_OF_PERSONS)
+		{
+			const std::vector<int>& assignment = matchClusters();
+			trackClusters(frameNr, assignment);
+		}
+		colorVoxels(m_assignment);
+
+		// Once the buffers have grown to the size of the scene, a frame should not touch the heap
+		size_t allocated = alloc_counter::count() - allocations;
+		if (alloc_counter::enabled() && ++m_updates > util::K_ALLOC_WARMUP_FRAMES && allocated > 0)
+			WARN("Frame update made {} heap allocations", allocated);
+
+		// After the check, every exported mesh is handed to the writer in its own allocation
+		if (m_stream_meshes)
+			exportMeshes();
 	}
 
 	/**
@@ -379,254 +618,592 @@ namespace team45
 	 */
 	void VoxelReconstruction::updateVoxels()
 	{
+		TRACE_SCOPE("updateVoxels");
+		m_changed_voxels.clear();
+		std::mutex visible_mutex;
 		for (int c = 0; c < m_cameras.size(); c++)
 		{
 			cv::Size camSize = m_cameras[c]->getSize();
-			int nrOfPixels = camSize.width * camSize.height;
 
-			int p;
-#pragma omp parallel for schedule(static) private(p) shared(m_visible_voxels)
-			for (p = 0; p < nrOfPixels; ++p)
+			// Tiles of rows, a voxel projects on one pixel per camera so only the visible list is shared
+			TaskPool::get().parallelForRange(0, camSize.height, util::K_CARVE_TILE_ROWS, [&](int rowBegin, int rowEnd)
 			{
-				int py = p / camSize.width;
-				int px = p % camSize.width;
-				Point point = cv::Point2f(px, py);
+				TRACE_SCOPE_ARG("updateVoxels tile", c);
+				for (int p = rowBegin * camSize.width; p < rowEnd * camSize.width; ++p)
+				{
+					int py = p / camSize.width;
+					int px = p % camSize.width;
+					Point point = cv::Point2f(px, py);
 
-				// Only continue if this pixel has changed compared to the previous frame
-				// This means that the pixel should be on in the binary difference  
-				if (m_cameras[c]->getBinaryDifference().at<uchar>(point) < 255) continue;
+					// Only continue if this pixel has changed compared to the previous frame
+					// This means that the pixel should be on in the binary difference  
+					if (m_cameras[c]->getBinaryDifference().at<uchar>(point) < 255) continue;
 
-				// Now we know that this pixel was on in the binary difference
-				auto iterator = m_lookup[c].find(p);
-				// This pixel does not have voxels mapped to it
-				if (iterator == m_lookup[c].end()) continue;
+					// Now we know that this pixel was on in the binary difference
+					auto iterator = m_lookup[c].find(p);
+					// This pixel does not have voxels mapped to it
+					if (iterator == m_lookup[c].end()) continue;
 
-				// Voxels mapped to this pixel, so evaluate them
-				for (int v = 0; v < iterator->second.size(); v++)
-				{
-					Voxel* voxel = iterator->second[v];
+					// Voxels mapped to this pixel, so evaluate them
+					for (int v = 0; v < iterator->second.size(); v++)
+					{
+						Voxel* voxel = iterator->second[v];
 
-					// Get the current status of the pixel at the point
-					int voxelFlag = m_cameras[c]->getForegroundImage().at<uchar>(point) == 255;
-					// Check if the voxel was on in the previous frame
-					bool voxelOnPrev = voxel->camera_flags == m_all_camera_flags;
+						// Get the current status of the pixel at the point
+						int voxelFlag = m_cameras[c]->getForegroundImage().at<uchar>(point) == 255;
+						// Check if the voxel was on in the previous frame
+						bool voxelOnPrev = voxel->camera_flags == m_all_camera_flags;
 
-					// Set flag c to voxelOnPrev's value
-					// First use a mask to turn off flag c
-					voxel->camera_flags &= ~(1 << c);
-					// Then make flag c equal to voxelFlag's value
-					voxel->camera_flags |= voxelFlag << c;
+						// Set flag c to voxelOnPrev's value
+						// First use a mask to turn off flag c
+						voxel->camera_flags &= ~(1 << c);
+						// Then make flag c equal to voxelFlag's value
+						voxel->camera_flags |= voxelFlag << c;
 
-					bool voxelOnNow = voxel->camera_flags == m_all_camera_flags;
+						bool voxelOnNow = voxel->camera_flags == m_all_camera_flags;
+						if (voxelOnPrev == voxelOnNow) continue;
 
-#pragma omp critical // The following operations are critical, since visible_voxels is shared by the threads
-					{
-						if (voxelOnPrev && !voxelOnNow)
 						{
-							// Remove the voxel from visible_voxels
-							m_visible_voxels[voxel->visibleIndex] = m_visible_voxels[m_visible_voxels.size() - 1];
-							m_visible_voxels[voxel->visibleIndex]->visibleIndex = voxel->visibleIndex;
+							// visible_voxels and the floor grid are shared by the tiles
+							std::lock_guard<std::mutex> lock(visible_mutex);
+							if (voxelOnPrev && !voxelOnNow)
+							{
+								// Remove the voxel from visible_voxels
+								m_visible_voxels[voxel->visibleIndex] = m_visible_voxels[m_visible_voxels.size() - 1];
+								m_visible_voxels[voxel->visibleIndex]->visibleIndex = voxel->visibleIndex;
 
-							m_visible_voxels_gpu[voxel->visibleIndex] = m_visible_voxels_gpu[m_visible_voxels_gpu.size() - 1];
+								voxel->visibleIndex = -1;
 
-							voxel->visibleIndex = -1;
+								m_visible_voxels.resize(m_visible_voxels.size() - 1);
 
-							m_visible_voxels.resize(m_visible_voxels.size() - 1);
-							m_visible_voxels_gpu.resize(m_visible_voxels_gpu.size() - 1);
-						}
-						else if (!voxelOnPrev && voxelOnNow)
-						{
-							// Add the voxel to visible_voxels
-							m_visible_voxels.push_back(voxel);
-							m_visible_voxels_gpu.push_back(createVoxelGPU(*voxel));
-							voxel->visibleIndex = m_visible_voxels.size() - 1;
+								m_floor_grid.remove(voxel->position);
+								m_changed_voxels.push_back(voxel);
+							}
+							else if (!voxelOnPrev && voxelOnNow)
+							{
+								// Add the voxel to visible_voxels, its color is sampled again
+								voxel->color_cameras = -1;
+								m_visible_voxels.push_back(voxel);
+								voxel->visibleIndex = m_visible_voxels.size() - 1;
+
+								m_floor_grid.add(voxel->position);
+								m_changed_voxels.push_back(voxel);
+							}
 						}
 					}
 				}
+			});
+		}
+
+		updateSurface();
+	}
+
+	/**
+	 * Only the voxels that changed and their face neighbours can have entered or left the surface
+	 */
+	void VoxelReconstruction::updateSurface()
+	{
+		TRACE_SCOPE("updateSurface");
+		static const glm::ivec3 neighbours[6] = { {1,0,0}, {-1,0,0}, {0,1,0}, {0,-1,0}, {0,0,1}, {0,0,-1} };
+
+		for (Voxel* voxel : m_changed_voxels)
+		{
+			refreshSurface(voxel);
+			const glm::ivec3 grid = (glm::ivec3(voxel->position) - m_origin) / m_step;
+			for (auto& offset : neighbours)
+			{
+				const glm::ivec3 n = grid + offset;
+				Voxel* neighbour = voxelAt(n.x, n.y, n.z);
+				if (neighbour != nullptr)
+					refreshSurface(neighbour);
 			}
 		}
 	}
 
+	/**
+	 * Adds the voxel to, or removes it from m_surface_voxels
+	 * A voxel is on the surface if it's visible and at least one face neighbour is not (or lies outside the space)
+	 */
+	void VoxelReconstruction::refreshSurface(Voxel* voxel)
+	{
+		bool surface = false;
+		if (voxel->visibleIndex >= 0)
+		{
+			const glm::ivec3 grid = (glm::ivec3(voxel->position) - m_origin) / m_step;
+			Voxel* neighbours[6] = {
+				voxelAt(grid.x + 1, grid.y, grid.z), voxelAt(grid.x - 1, grid.y, grid.z),
+				voxelAt(grid.x, grid.y + 1, grid.z), voxelAt(grid.x, grid.y - 1, grid.z),
+				voxelAt(grid.x, grid.y, grid.z + 1), voxelAt(grid.x, grid.y, grid.z - 1) };
+			for (Voxel* neighbour : neighbours)
+				surface |= neighbour == nullptr || neighbour->visibleIndex < 0;
+		}
+
+		if (surface && voxel->surfaceIndex < 0)
+		{
+			voxel->surfaceIndex = (int)m_surface_voxels.size();
+			m_surface_voxels.push_back(voxel);
+			m_surface_voxels_gpu.push_back(createVoxelGPU(*voxel));
+			m_surface_voxels_dirty.push_back(1);
+		}
+		else if (!surface && voxel->surfaceIndex >= 0)
+		{
+			// Move the last surface voxel into the gap
+			const int last = (int)m_surface_voxels.size() - 1;
+			m_surface_voxels[voxel->surfaceIndex] = m_surface_voxels[last];
+			m_surface_voxels[voxel->surfaceIndex]->surfaceIndex = voxel->surfaceIndex;
+			m_surface_voxels_gpu[voxel->surfaceIndex] = m_surface_voxels_gpu[last];
+			m_surface_voxels_dirty[voxel->surfaceIndex] = 1;
+
+			voxel->surfaceIndex = -1;
+
+			m_surface_voxels.resize(last);
+			m_surface_voxels_gpu.resize(last);
+			m_surface_voxels_dirty.resize(last);
+		}
+	}
+
+	/**
+	 * @return The voxel at grid coordinate (x, y, z), nullptr outside the space
+	 */
+	Voxel* VoxelReconstruction::voxelAt(int x, int y, int z) const
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= m_dimensions.x || y >= m_dimensions.y || z >= m_dimensions.z)
+			return nullptr;
+		return m_voxels[((size_t)z * m_dimensions.y + y) * m_dimensions.x + x];
+	}
+
 	void VoxelReconstruction::labelVoxels()
 	{
-		std::vector<cv::Point2f> voxel_points;
-		// Reserve memory so that we can parallelize the projection to 2d
-		voxel_points.resize(m_visible_voxels.size());
+		TRACE_SCOPE("labelVoxels");
+		// Resize so that we can parallelize the projection to 2d, keeps the capacity of earlier frames
+		m_voxel_points.resize(m_visible_voxels.size());
 
-		int v;
-#pragma omp parallel for schedule(static) private(v) shared(voxel_points, m_visible_voxels)
-		for (v = 0; v < m_visible_voxels.size(); v++)
+		TaskPool::get().parallelFor(0, (int)m_visible_voxels.size(), 4096, [&](int v)
 		{
 			Voxel* voxel = m_visible_voxels[v];
 			// Discard the z-coordinate
 			cv::Point2f point(voxel->position.x, voxel->position.y);
-			voxel_points[v] = point;
+			m_voxel_points[v] = point;
+		});
+
+		// The occupied floor columns tell us how many people there are
+		int persons = m_floor_grid.label();
+		if (persons != m_estimated_persons)
+		{
+			DEBUG("Floor grid estimates {} persons", persons);
+			m_estimated_persons = persons;
 		}
 
-		TermCriteria criteria(cv::TermCriteria::EPS, 0, 0);
-		int flags = cv::KMEANS_PP_CENTERS;
+		// k-means needs at least one voxel per cluster, so keep the previous centers
+		if (m_voxel_points.size() < util::K_NR_OF_PERSONS)
+		{
+			resizeLabels((int)m_voxel_points.size());
+			m_labels.setTo(0);
+			return;
+		}
+
+		if (m_cluster_mode == ClusterMode::FloorGrid && labelFloorGrid())
+			return;
+
+		// People only move a few centimeters between frames, so the previous centers are a good first guess.
+		// This is also the fallback of the floor grid when it doesn't find every person
+		bool warmStart = (m_cluster_mode == ClusterMode::WarmStart || m_cluster_mode == ClusterMode::FloorGrid)
+			&& m_cluster_centers.rows == util::K_NR_OF_PERSONS
+			&& m_reference_compactness > 0;
+
+		if (warmStart)
+		{
+			double compactness = warmStartKmeans();
+
+			// Only accept the result as long as the clusters are about as tight as after the last full restart
+			if (compactness / m_voxel_points.size() <= m_reference_compactness * util::K_WARM_COMPACTNESS_FACTOR)
+				return;
+
+			DEBUG("Warm-started clustering degraded ({} > {}), restarting", compactness / m_voxel_points.size(), m_reference_compactness);
+		}
 
-		double compactness = cv::kmeans(voxel_points, util::K_NR_OF_PERSONS, m_labels, criteria, util::K_NR_OF_ATTEMPTS, flags, m_cluster_centers);
+		double compactness = restartKmeans();
+		m_reference_compactness = compactness / m_voxel_points.size();
 	}
 
 	/*
-		Match each of the voxel clusters with a color model.
-		To do this, we first need to create a model for each view.
-		Then compare all the views and use an appropriate scale to compare them.
+		k-means on the floor positions, starting from the previous frame's centers
+		@return Compactness, the sum of squared distances of the voxels to their center
 	*/
-	int VoxelReconstruction::matchClusters()
+	double VoxelReconstruction::warmStartKmeans()
 	{
-		// key	 = permutation index 
-		// value = <#cams who made that observation, confidence>
-		std::map<int, std::pair<int, float>> observations;
+		resizeLabels((int)m_voxel_points.size());
 
-		// A color model, per view, per person
-		for (int c = 0; c < m_cameras.size(); c++)
-		{
-			// Create color model for this camera so we can compare it to the offline models  
-			std::vector<Histogram*> models;
-			createColorModels(c, models);
+		std::array<cv::Point2f, util::K_NR_OF_PERSONS> centers;
+		for (int k = 0; k < util::K_NR_OF_PERSONS; k++)
+			centers[k] = cv::Point2f(m_cluster_centers.at<float>(k, 0), m_cluster_centers.at<float>(k, 1));
 
-			int perm;
-			float difference = matchModels(m_cameras[c]->getColorModels(), models, perm);
+		double compactness = lloyd(centers.data(), util::K_WARM_MAX_ITERATIONS, util::K_WARM_EPSILON);
 
-			auto it = observations.find(perm);
-			if (it != observations.end())
+		for (int k = 0; k < util::K_NR_OF_PERSONS; k++)
+		{
+			m_cluster_centers.at<float>(k, 0) = centers[k].x;
+			m_cluster_centers.at<float>(k, 1) = centers[k].y;
+		}
+		return compactness;
+	}
+
+	/*
+		k-means++ from scratch, K_NR_OF_ATTEMPTS times, keeping the labels and centers of the most compact attempt.
+		The same as cv::kmeans with KMEANS_PP_CENTERS, but in the reusable buffers (cv::kmeans allocates its own every call).
+		@return Compactness of the kept attempt
+	*/
+	double VoxelReconstruction::restartKmeans()
+	{
+		const int n = (int)m_voxel_points.size();
+		resizeLabels(n);
+		m_seed_distances.resize(n);
+		m_best_labels.resize(n);
+
+		std::array<cv::Point2f, util::K_NR_OF_PERSONS> centers, bestCenters;
+		double best = DBL_MAX;
+		for (int attempt = 0; attempt < util::K_NR_OF_ATTEMPTS; attempt++)
+		{
+			// k-means++, every next center is picked with a probability proportional to its squared distance to the closest center
+			std::fill(m_seed_distances.begin(), m_seed_distances.end(), FLT_MAX);
+			centers[0] = m_voxel_points[std::uniform_int_distribution<int>(0, n - 1)(m_rng)];
+			for (int k = 1; k < util::K_NR_OF_PERSONS; k++)
 			{
-				it->second.first++;
-				it->second.second += difference;
+				const cv::Point2f last = centers[k - 1];
+				double total = TaskPool::get().parallelSum(0, n, 4096, 0.0, [&](int begin, int end)
+				{
+					double partial = 0;
+					for (int v = begin; v < end; v++)
+					{
+						cv::Point2f d = m_voxel_points[v] - last;
+						m_seed_distances[v] = std::min(m_seed_distances[v], d.dot(d));
+						partial += m_seed_distances[v];
+					}
+					return partial;
+				});
+
+				double target = std::uniform_real_distribution<double>(0, total)(m_rng);
+				int pick = 0;
+				for (; pick < n - 1; pick++)
+				{
+					target -= m_seed_distances[pick];
+					if (target <= 0) break;
+				}
+				centers[k] = m_voxel_points[pick];
 			}
-			else
+
+			double compactness = lloyd(centers.data(), util::K_RESTART_MAX_ITERATIONS, 0);
+			if (compactness < best)
 			{
-				observations[perm] = std::pair(1, difference);
+				best = compactness;
+				bestCenters = centers;
+				std::copy(m_label_buffer.begin(), m_label_buffer.begin() + n, m_best_labels.begin());
 			}
 		}
 
-		// If we only have 1 observation, all cameras labeled the clusters the same
-		// Otherwise we will take the observation with the lowest average difference will be used
-		int permutation;
-		//INFO("Amount of different cluster labelings: {}", observations.size());
-		if (observations.size() == 1)
+		std::copy(m_best_labels.begin(), m_best_labels.end(), m_label_buffer.begin());
+		m_cluster_centers.create(util::K_NR_OF_PERSONS, 2, CV_32F);
+		for (int k = 0; k < util::K_NR_OF_PERSONS; k++)
 		{
-			permutation = observations.begin()->first;
+			m_cluster_centers.at<float>(k, 0) = bestCenters[k].x;
+			m_cluster_centers.at<float>(k, 1) = bestCenters[k].y;
 		}
-		else
+		return best;
+	}
+
+	/*
+		Lloyd iterations on the floor positions, in place on the label buffer
+		@param centers K_NR_OF_PERSONS centers, moved to the mean of their voxels
+		@param epsilon Center movement (mm) at which the iterations stop
+		@return Compactness, the sum of squared distances of the voxels to their center
+	*/
+	double VoxelReconstruction::lloyd(cv::Point2f* centers, int maxIterations, double epsilon)
+	{
+		const int n = (int)m_voxel_points.size();
+		double compactness = 0;
+		for (int iteration = 0; iteration < maxIterations; iteration++)
 		{
-			float lowestDifference = FLT_MAX;
-			auto it = observations.begin();
-			while (it != observations.end())
+			// Give every voxel the label of its nearest center
+			// Summed in chunk order, so the restart decision doesn't depend on the number of workers
+			compactness = TaskPool::get().parallelSum(0, n, 2048, 0.0, [&](int begin, int end)
 			{
-				// divide total error by the amount of camera's that have seen that permutation
-				float difference = it->second.second / (float)it->second.first;
-				if (difference < lowestDifference)
+				double partial = 0;
+				for (int v = begin; v < end; v++)
 				{
-					lowestDifference = difference;
-					permutation = it->first;
+					int closest = 0;
+					float shortestDist = FLT_MAX;
+					for (int k = 0; k < util::K_NR_OF_PERSONS; k++)
+					{
+						cv::Point2f d = m_voxel_points[v] - centers[k];
+						float dist = d.dot(d);
+						if (dist < shortestDist)
+						{
+							shortestDist = dist;
+							closest = k;
+						}
+					}
+					m_labels.at<int>(v) = closest;
+					partial += shortestDist;
 				}
-				it++;
+				return partial;
+			});
+
+			// Move every center to the mean of its voxels
+			std::array<cv::Point2d, util::K_NR_OF_PERSONS> sums;
+			std::array<int, util::K_NR_OF_PERSONS> counts;
+			sums.fill(cv::Point2d(0, 0));
+			counts.fill(0);
+			for (int v = 0; v < n; v++)
+			{
+				int label = m_labels.at<int>(v);
+				sums[label] += cv::Point2d(m_voxel_points[v]);
+				counts[label]++;
+			}
+
+			double maxShift = 0;
+			for (int k = 0; k < util::K_NR_OF_PERSONS; k++)
+			{
+				// An empty cluster keeps its old center
+				if (counts[k] == 0) continue;
+				cv::Point2f center(sums[k] / counts[k]);
+				cv::Point2f d = center - centers[k];
+				maxShift = std::max(maxShift, (double)d.dot(d));
+				centers[k] = center;
 			}
+
+			if (maxShift <= epsilon * epsilon)
+				break;
 		}
+		return compactness;
+	}
 
-		return permutation;
+	/*
+		Point m_labels at the first rows of the label buffer, which only grows
+	*/
+	void VoxelReconstruction::resizeLabels(int rows)
+	{
+		if (m_label_buffer.size() < rows)
+			m_label_buffer.resize(rows);
+		m_labels = cv::Mat(rows, 1, CV_32S, m_label_buffer.data());
 	}
 
-	void VoxelReconstruction::createColorModels(int cam, std::vector<Histogram*>& histograms)
+	/*
+		Label the voxels with the floor grid component they stand on.
+		Only possible when there is one component per person, otherwise returns false.
+	*/
+	bool VoxelReconstruction::labelFloorGrid()
 	{
-		std::vector<std::vector<Point3f>> pixelsPerPerson;
-		pixelsPerPerson.resize(util::K_NR_OF_PERSONS);
+		const std::vector<cv::Point2f>& centers = m_floor_grid.getCenters();
+		if (centers.size() != util::K_NR_OF_PERSONS)
+			return false;
+
+		// Give each previous cluster the closest component, so every person keeps their label
+		std::pmr::vector<int> componentOf(util::K_NR_OF_PERSONS, &m_frame_arena);
+		std::iota(componentOf.begin(), componentOf.end(), 0);
+		if (m_cluster_centers.rows == util::K_NR_OF_PERSONS)
+		{
+			std::pmr::vector<std::pmr::vector<float>> distances(util::K_NR_OF_PERSONS, &m_frame_arena);
+			for (int k = 0; k < util::K_NR_OF_PERSONS; k++)
+			{
+				cv::Point2f previous(m_cluster_centers.at<float>(k, 0), m_cluster_centers.at<float>(k, 1));
+				distances[k].resize(centers.size());
+				for (int c = 0; c < centers.size(); c++)
+					distances[k][c] = (float)cv::norm(centers[c] - previous);
+			}
+			float total;
+			util::hungarian(distances, componentOf, total, &m_frame_arena);
+		}
+
+		std::pmr::vector<int> labelOf(centers.size(), &m_frame_arena);
+		m_cluster_centers.create(util::K_NR_OF_PERSONS, 2, CV_32F);
+		for (int k = 0; k < util::K_NR_OF_PERSONS; k++)
+		{
+			labelOf[componentOf[k]] = k;
+			m_cluster_centers.at<float>(k, 0) = centers[componentOf[k]].x;
+			m_cluster_centers.at<float>(k, 1) = centers[componentOf[k]].y;
+		}
+
+		resizeLabels((int)m_visible_voxels.size());
+		TaskPool::get().parallelFor(0, (int)m_visible_voxels.size(), 4096, [&](int v)
+		{
+			const glm::vec3& position = m_visible_voxels[v]->position;
+			int component = m_floor_grid.component(position);
+			if (component >= 0)
+			{
+				m_labels.at<int>(v) = labelOf[component];
+				return;
+			}
 
-		auto& tempFrame = m_cameras[cam]->getFrame();
-		//cv::imshow(util::get_name_rand("Frame of cam", cam), tempFrame);
-		cv::Mat frame;
-		tempFrame.convertTo(frame, CV_32F);
+			// Voxels in sparse columns go to the closest person
+			int closest = 0;
+			float shortestDist = FLT_MAX;
+			for (int k = 0; k < util::K_NR_OF_PERSONS; k++)
+			{
+				float dist = (float)cv::norm(centers[componentOf[k]] - cv::Point2f(position.x, position.y));
+				if (dist < shortestDist)
+				{
+					shortestDist = dist;
+					closest = k;
+				}
+			}
+			m_labels.at<int>(v) = closest;
+		});
 
-		int v;
-		//#pragma omp parallel for schedule(static) private(v) shared(voxel_bitmap)
+		return true;
+	}
 
-		// For every visible voxel above z = 700, get the color and add it to the corresponding label
-		for (v = 0; v < m_visible_voxels.size(); v++)
+	/*
+		Splat the labeled visible voxels into the first-hit map of every camera,
+		so occlusion queries don't have to search the lookup tables
+	*/
+	void VoxelReconstruction::updateVisibility()
+	{
+		TRACE_SCOPE("updateVisibility");
+		TaskPool::get().parallelFor(0, (int)m_cameras.size(), 1, [this](int c)
 		{
-			Voxel* voxel = m_visible_voxels[v];
+			m_visibility[c].build(m_visible_voxels, m_labels, c, m_cameras[c]->getSize());
+		});
+	}
 
-			//if (voxel->position.z < 700)
-			//	continue;
+	/*
+		Match each of the voxel clusters with a color model.
+		To do this, we first need to create a model for each view.
+		Then compare all the views and use an appropriate scale to compare them.
+	*/
+	const std::vector<int>& VoxelReconstruction::matchClusters()
+	{
+		TRACE_SCOPE("matchClusters");
+		// An assignment of clusters to persons, the #cams who made that observation and their total difference
+		struct Observation
+		{
+			std::pmr::vector<int> assignment;
+			int count;
+			float difference;
+		};
+		// At most one observation per camera, so a linear search beats a map
+		std::pmr::vector<Observation> observations(&m_frame_arena);
+		observations.reserve(m_cameras.size());
 
-			int label = m_labels.at<int>(v);
+		// A color model, per view, per person
+		// The cameras only read shared state, so their models are built concurrently
+		// and the voxel chunks of every camera are spread over the workers that are left
+		TaskPool::get().parallelFor(0, (int)m_cameras.size(), 1, [this](int cam) { createColorModels(cam); });
 
-			cv::Point2f p = voxel->pixelProjections[cam];
-			int xOff = 2;
-			int yOff = 2;
+		// Match in camera order, so the observations are the same as in a serial run
+		std::pmr::vector<int> assignment(&m_frame_arena);
+		for (int c = 0; c < m_cameras.size(); c++)
+		{
+			float difference = matchModels(m_cameras[c]->getColorModels(), m_frame_model_order[c], assignment);
 
-			Voxel* closest = voxel;
-			for (int y = p.y - yOff; y <= p.y + yOff; y++)
+			auto it = std::find_if(observations.begin(), observations.end(),
+				[&assignment](const Observation& o) {
+					return o.assignment == assignment;
+				});
+			if (it != observations.end())
 			{
-				if (closest != voxel)
-					break;
-				for (int x = p.x - xOff; x <= p.x + xOff; x++)
-				{
-					if (closest != voxel)
-						break;
-
-					int pixelIndex = x + y * m_cameras[cam]->getSize().width;
-					// Iterator over the lookup table from the camera (all pixels)
-					auto mapIt = m_lookup[cam].find(pixelIndex);
-					// Check if our pixel is on the screen / has voxels mapped to it
-					if (mapIt == m_lookup[cam].end())
-						continue;
-
-					auto voxels = mapIt->second;
-
-					// Iterator over the voxels from a single pixel
-					auto vecIt = voxels.begin();
-					// Move our iterator to the first voxel that is on in all cameras
-					// The voxels are ordered on distance 
-					while (vecIt != voxels.end() && (*vecIt)->camera_flags != m_all_camera_flags)
-						vecIt++;
-					// Double check that we found a voxel
-					if (vecIt == voxels.end())
-						continue;
-
-					if ((*vecIt)->distances[cam] < closest->distances[cam] && m_labels.at<int>((*vecIt)->visibleIndex) != label)
-						closest = *vecIt;
-				}
+				it->count++;
+				it->difference += difference;
+			}
+			else
+			{
+				observations.push_back({ std::pmr::vector<int>(assignment, &m_frame_arena), 1, difference });
 			}
+		}
 
-			// Voxel is occluded
-			if (closest != voxel)
-				continue;
+		// If we only have 1 observation, all cameras labeled the clusters the same
+		// Otherwise we will take the observation with the lowest average difference will be used
+		//INFO("Amount of different cluster labelings: {}", observations.size());
+		float lowestDifference = FLT_MAX;
+		const Observation* best = &observations.front();
+		for (auto& observation : observations)
+		{
+			// divide total error by the amount of camera's that have seen that assignment
+			float difference = observation.difference / (float)observation.count;
+			// On a tie the smallest assignment wins, independent of the camera order
+			if (difference < lowestDifference || (difference == lowestDifference && observation.assignment < best->assignment))
+			{
+				lowestDifference = difference;
+				best = &observation;
+			}
+		}
 
-			for (int y = p.y - yOff; y <= p.y + yOff; y++)
+		std::copy(best->assignment.begin(), best->assignment.end(), m_assignment.begin());
+		return m_assignment;
+	}
+
+	void VoxelReconstruction::createColorModels(int cam)
+	{
+		TRACE_SCOPE_ARG("createColorModels", cam);
+		const cv::Mat& frame = m_cameras[cam]->getFrame();
+		//cv::imshow(util::get_name_rand("Frame of cam", cam), frame);
+
+		// Every chunk of voxels fills its own partial histograms, so the chunks can run on any thread.
+		// The bins hold whole pixel counts, so merging them in chunk order gives exactly the serial result.
+		const int voxelCount = (int)m_visible_voxels.size();
+		const int chunks = util::K_COLOR_MODEL_CHUNKS;
+		std::vector<std::vector<Histogram>>& partials = m_partial_models[cam];
+
+		TaskPool::get().parallelFor(0, chunks, 1, [&](int chunk)
+		{
+			std::vector<Histogram>& partial = partials[chunk];
+			for (auto& histogram : partial)
+				histogram.clear();
+			const int begin = (int)((int64_t)voxelCount * chunk / chunks);
+			const int end = (int)((int64_t)voxelCount * (chunk + 1) / chunks);
+
+			for (int v = begin; v < end; v++)
 			{
-				for (int x = p.x - xOff; x <= p.x + xOff; x++)
+				Voxel* voxel = m_visible_voxels[v];
+				int label = m_labels.at<int>(v);
+
+				// Skip the voxel if a closer voxel of another person is the first hit around its projection
+				if (m_visibility[cam].isOccluded(*voxel, cam, label, util::K_OCCLUSION_RADIUS))
+					continue;
+
+				const cv::Point& p = voxel->pixelProjections[cam];
+				const int xOff = util::K_OCCLUSION_RADIUS;
+				const int yOff = util::K_OCCLUSION_RADIUS;
+
+				for (int y = p.y - yOff; y <= p.y + yOff; y++)
 				{
-					cv::Point2f pOff = cv::Point2f(x, y);
-					pixelsPerPerson[label].push_back(frame.at<Point3f>(pOff));
+					if (y < 0 || y >= frame.rows) continue;
+					const cv::Vec3b* row = frame.ptr<cv::Vec3b>(y);
+					for (int x = p.x - xOff; x <= p.x + xOff; x++)
+					{
+						if (x < 0 || x >= frame.cols) continue;
+						partial[label].add(row[x]);
+					}
 				}
 			}
-		}
+		});
 
-		for (int i = 0; i < pixelsPerPerson.size(); i++)
+		std::vector<Histogram>& histograms = m_frame_models[cam];
+		for (int i = 0; i < util::K_NR_OF_PERSONS; i++)
 		{
-			Histogram* h = new Histogram(m_bins);
-			h->calculate(pixelsPerPerson[i]);
-			histograms.push_back(h);
+			histograms[i].clear();
+			for (int c = 0; c < chunks; c++)
+				histograms[i].merge(partials[c][i]);
+			histograms[i].normalize();
+			histograms[i].setId(i);
+			m_frame_model_order[cam][i] = &histograms[i];
 		}
 	}
 	static int x = 0;
 
-	void VoxelReconstruction::trackClusters(int permutation)
+	void VoxelReconstruction::trackClusters(int frameNr, const std::vector<int>& assignment)
 	{
-		if (m_saved_2d_tracking) return;
-
-		for (int c = 0; c < util::K_NR_OF_PERSONS; c++)
+		TRACE_SCOPE("trackClusters");
+		for (int i = 0; i < util::K_NR_OF_PERSONS; i++)
 		{
-			auto p = m_permutations[permutation];
-			int i = 0;
-			for (; i < p.size(); i++)
-			{
-				if (p[i] == c)
-					break;
-			}
+			// Cluster that person i is assigned to
+			int c = assignment[i];
+			cv::Point2f position = m_tracker.correct(i, cv::Point2f(m_cluster_centers.at<float>(c, 0), m_cluster_centers.at<float>(c, 1)));
+			cv::Point2f velocity = m_tracker.getVelocity(i);
+			m_track_records[i] = { frameNr, (int16_t)i, (uint16_t)(m_tracker.isCoasting(i) ? TRACK_COASTED : 0),
+				position.x, position.y, velocity.x, velocity.y };
+
+			// The tracks are final once saved, the filter keeps running for the cluster seeds
+			if (m_saved_2d_tracking) continue;
 
 			static std::vector<glm::vec3> colors
 			{
@@ -636,45 +1213,14 @@ namespace team45
 				{1,0,1}		// purple
 			};
 
-			auto pos = glm::vec3(m_cluster_centers.at<float>(c, 0), m_cluster_centers.at<float>(c, 1), 0);
-			
 			Vertex v;
-			v.Position = pos;
+			v.Position = glm::vec3(position.x, position.y, 0);
 			v.Color = glm::vec4(colors[i], 1);
 			m_2d_tracking[i].push_back(v);
 		}
-	}
-
-	/*
-		Smooths the 2d points that represent the paths of the voxel reconstructed people
-		Does this by removing any outliers (large jumps) 
-	*/
-	void VoxelReconstruction::smooth2dTracking()
-	{
-		if (m_saved_2d_tracking) return;
 
-		int n = 0;
-		for (int i = 0; i < m_2d_tracking.size(); i++)
-		{
-			for(int p = 1; p < m_2d_tracking[i].size(); p++)
-			{
-				Vertex v = m_2d_tracking[i][p];
-				Vertex vprev = m_2d_tracking[i][p - 1];
-
-				float dist = glm::distance(v.Position, vprev.Position);
-				if(dist > util::K_OUTLIER_MAX_DIST * n)
-				{
-					// Outlier detected! Remove from vector and lower index
-					m_2d_tracking[i].erase(m_2d_tracking[i].begin() + p);
-					p--;
-					n++;
-				}
-				else
-				{
-					n = 0;
-				}
-			}
-		}
+		if (m_track_log.isOpen())
+			m_track_log.append(m_track_records.data(), m_track_records.size());
 	}
 
 	void VoxelReconstruction::save2dTracking()
@@ -700,32 +1246,24 @@ namespace team45
 		INFO("Done saving 2D tracking!");		
 	}
 
-	void VoxelReconstruction::colorVoxels(int permutation)
+	void VoxelReconstruction::colorVoxels(const std::vector<int>& assignment)
 	{
-		//INFO("Permutation used in coloring: {} {} {} {}", m_permutations[permutation][0], m_permutations[permutation][1], m_permutations[permutation][2], m_permutations[permutation][3]);
+		TRACE_SCOPE("colorVoxels");
+		if (m_color_mode != ColorMode::Labels)
+		{
+			sampleVoxelColors();
+			return;
+		}
+
+		// Person per cluster label
+		std::array<int, util::K_NR_OF_PERSONS> personOf;
+		for (int i = 0; i < assignment.size(); i++)
+			personOf[assignment[i]] = i;
 
 		for (int v = 0; v < m_visible_voxels.size(); v++)
 		{
 			Voxel* voxel = m_visible_voxels[v];
 
-			/*
-			// Find the closest camera
-			// Can be changed to either the camera with the smallest angle,
-			// Or maybe the camera to which the normal on the voxel (if we can calculate it with it's neighbourhood) points towards?
-			int cam;
-			float closestDistance = 3.40281e+038;
-			for (int c = 0; c < m_cameras.size(); c++)
-			{
-				if (voxel->distances[c] >= closestDistance)
-					continue;
-				cam = c;
-				closestDistance = voxel->distances[c];
-			}
-
-			// For now, color the voxel using the front camera
-			colorVoxel(voxel, 1);
-			*/
-
 			static std::vector<glm::vec3> colors
 			{
 				{1,0,0},	// red
@@ -734,95 +1272,218 @@ namespace team45
 				{1,0,1}		// purple
 			};
 			int label = m_labels.at<int>(v);
-			auto p = m_permutations[permutation];
-			int i = 0;
-			for (; i < p.size(); i++)
-			{
-				if (p[i] == label)
-					break;
-			}
-
-			voxel->color = colors[i];
-
-			m_visible_voxels_gpu[v].color = voxel->color;
+			setVoxelColor(voxel, colors[personOf[label]]);
+			// The sampled color is overwritten, so sample it again when the mode changes back
+			voxel->color_cameras = -1;
 		}
+		m_colored_mode = ColorMode::Labels;
 	}
 
-	bool VoxelReconstruction::colorVoxel(Voxel* voxel, int cam)
+	/*
+		Color the visible voxels with the pixels they project to, in the cameras that see them.
+		A voxel is only sampled again when the cameras that see it, or the pixels it was sampled from, changed.
+	*/
+	void VoxelReconstruction::sampleVoxelColors()
 	{
-		// Area around the pixel that we check for occlusions
-		int xOffset = 2;
-		int yOffset = xOffset;
+		const bool resample = m_colored_mode != m_color_mode;
+		// A voxel keeps the sampled pixels of at most MAX_CAMERAS cameras
+		const int cams = std::min((int)m_cameras.size(), MAX_CAMERAS);
 
-		cv::Point pixelPoint = voxel->pixelProjections[cam];
-		int pixelIndex = pixelPoint.x + pixelPoint.y * m_cameras[cam]->getSize().width;
+		TaskPool::get().parallelFor(0, (int)m_visible_voxels.size(), 256, [&](int v)
+		{
+			Voxel* voxel = m_visible_voxels[v];
 
-		Voxel* closestVoxel = voxel;
+			// A closer voxel around the projection hides this one from the camera
+			int seenBy = 0;
+			for (int c = 0; c < cams; c++)
+				if (!m_visibility[c].isOccluded(*voxel, c, -1, util::K_OCCLUSION_RADIUS))
+					seenBy |= 1 << c;
 
-		// Look in an area around the voxel to see if we can find an occluding voxel
-		for (int y = pixelPoint.y - yOffset; y <= pixelPoint.y + yOffset; y++)
-		{
-			// Early stop once we find a closer voxel that occludes the current one
-			if (closestVoxel != voxel)
-				break;
-			for (int x = pixelPoint.x - xOffset; x <= pixelPoint.x + xOffset; x++)
-			{
-				// Early stop again once we find a closer voxel that occludes the current one
-				if (closestVoxel != voxel)
-					break;
+			bool changed = resample || seenBy != voxel->color_cameras;
+			for (int c = 0; c < cams && !changed; c++)
+				changed = (seenBy & (1 << c)) && pixelChanged(*voxel, c);
+			if (!changed)
+				return;
 
-				// Iterator over the lookup table from the camera (all pixels)
-				auto mapIt = m_lookup[cam].find(pixelIndex);
-				if (mapIt == m_lookup[cam].end())
+			glm::vec3 color(0);
+			if (m_color_mode == ColorMode::NearestCamera)
+			{
+				int nearest = -1;
+				for (int c = 0; c < cams; c++)
+					if ((seenBy & (1 << c)) && (nearest < 0 || voxel->distances[c] < voxel->distances[nearest]))
+						nearest = c;
+				if (nearest >= 0)
 				{
-					ERROR("Pixel from voxel projection has no lookup!");
-					return false;
+					const cv::Vec3b& bgr = m_cameras[nearest]->getFrame().at<cv::Vec3b>(voxel->pixelProjections[nearest]);
+					color = glm::vec3(bgr[2], bgr[1], bgr[0]) / 255.f;
 				}
-				auto voxels = mapIt->second;
-
-				// Iterator over the voxels from a single pixel
-				auto vecIt = voxels.begin();
-				// Move our iterator to the first voxel that is on in all cameras
-				while (vecIt != voxels.end() && (*vecIt)->camera_flags != m_all_camera_flags)
-					vecIt++;
-
-				// Double check that we found a voxel (not actually necessary if no rounding errors have occured)
-				if (vecIt == voxels.end())
+			}
+			else
+			{
+				// Closer cameras see more detail, so weigh them with the inverse squared distance
+				float total = 0;
+				for (int c = 0; c < cams; c++)
 				{
-					ERROR("Visible voxel was not found in the projected pixel vector!");
-					return false;
+					if (!(seenBy & (1 << c))) continue;
+					const cv::Vec3b& bgr = m_cameras[c]->getFrame().at<cv::Vec3b>(voxel->pixelProjections[c]);
+					float weight = 1.f / (voxel->distances[c] * voxel->distances[c]);
+					color += weight * glm::vec3(bgr[2], bgr[1], bgr[0]);
+					total += weight;
 				}
-				if ((*vecIt)->distances[cam] < closestVoxel->distances[cam])
-					closestVoxel = *vecIt;
+				if (total > 0)
+					color /= total * 255.f;
 			}
+
+			// Voxels no camera sees stay black
+			setVoxelColor(voxel, color);
+			voxel->color_cameras = seenBy;
+			for (int c = 0; c < cams; c++)
+				if (seenBy & (1 << c))
+					voxel->sampledPixels[c] = m_cameras[c]->getFrame().at<cv::Vec3b>(voxel->pixelProjections[c]);
+		});
+
+		m_colored_mode = m_color_mode;
+	}
+
+	/*
+		@return Whether the voxel's pixel on the camera differs noticeably from the one its color was last sampled from
+	*/
+	bool VoxelReconstruction::pixelChanged(const Voxel& voxel, int cam) const
+	{
+		const cv::Vec3b& now = m_cameras[cam]->getFrame().at<cv::Vec3b>(voxel.pixelProjections[cam]);
+		const cv::Vec3b& before = voxel.sampledPixels[cam];
+		for (int i = 0; i < 3; i++)
+			if (std::abs(now[i] - before[i]) > util::K_COLOR_CHANGE_THRESHOLD)
+				return true;
+		return false;
+	}
+
+	void VoxelReconstruction::reportMemory(MemoryReport& report) const
+	{
+		// Voxels and the per-camera vectors every voxel owns
+		size_t voxels = MemoryReport::bytes(m_voxels);
+		size_t perCamera = 0;
+		for (auto voxel : m_voxels)
+		{
+			voxels += sizeof(Voxel);
+			perCamera += MemoryReport::bytes(voxel->distances) + MemoryReport::bytes(voxel->pixelProjections);
 		}
+		report.add("Voxels", voxels);
+		report.add("Voxel per-camera vectors", perCamera);
 
-		if (closestVoxel == voxel)
+		// A std::map node holds the key/value pair plus three pointers and a color, padded to a pointer
+		size_t lookup = MemoryReport::bytes(m_lookup);
+		const size_t nodeSize = sizeof(std::pair<const int, std::vector<Voxel*>>) + 4 * sizeof(void*);
+		for (auto& map : m_lookup)
 		{
-			// We encounted no voxels that occlude the original voxel
-			// So we can color this voxel
-			Vec3b color = m_cameras[cam]->getFrame().at<Vec3b>(pixelPoint);
-			voxel->color = glm::vec3(color.val[2], color.val[1], color.val[0]) / 255.f;
-			return true;
+			lookup += map.size() * nodeSize;
+			for (auto& entry : map)
+				lookup += MemoryReport::bytes(entry.second);
 		}
+		report.add("Lookup tables", lookup);
+
+		report.add("Visible voxels", MemoryReport::bytes(m_visible_voxels));
+		report.add("Surface voxels", MemoryReport::bytes(m_changed_voxels) + MemoryReport::bytes(m_surface_voxels)
+			+ MemoryReport::bytes(m_surface_voxels_gpu) + MemoryReport::bytes(m_surface_voxels_dirty));
+		report.add("Labels and cluster centers", MemoryReport::bytes(m_label_buffer) + MemoryReport::bytes(m_cluster_centers));
+
+		size_t models = 0;
+		for (auto& camera : m_frame_models)
+			for (auto& model : camera)
+				models += model.memoryUsage();
+		for (auto& camera : m_partial_models)
+			for (auto& chunk : camera)
+				for (auto& model : chunk)
+					models += model.memoryUsage();
+		report.add("Per-frame color models", models);
+		report.add("Per-frame buffers", MemoryReport::bytes(m_voxel_points) + MemoryReport::bytes(m_arena_buffer)
+			+ MemoryReport::bytes(m_seed_distances) + MemoryReport::bytes(m_best_labels));
+
+		size_t visibility = 0;
+		for (auto& map : m_visibility)
+			visibility += MemoryReport::bytes(map.getDepth()) + MemoryReport::bytes(map.getIndex()) + MemoryReport::bytes(map.getLabel());
+		report.add("Visibility maps", visibility);
+
+		size_t tracking = MemoryReport::bytes(m_2d_tracking);
+		for (auto& track : m_2d_tracking)
+			tracking += MemoryReport::bytes(track);
+		report.add("2D tracking", tracking);
+
+		report.add("Bins", m_bins->memoryUsage());
+	}
 
-		// The voxel is occluded, so color it black
-		voxel->color = glm::vec3(0);
-		return false;
+	void VoxelReconstruction::logMemory() const
+	{
+		MemoryReport report;
+		reportMemory(report);
+		for (auto camera : m_cameras)
+			camera->reportMemory(report);
+		report.log("Memory usage (voxel step " + std::to_string(m_step) + ", " + std::to_string(m_voxels_amount) + " voxels)");
 	}
 
 	VoxelGPU VoxelReconstruction::createVoxelGPU(Voxel const& voxel)
 	{
 		VoxelGPU vgpu;
-		vgpu.color = voxel.color;
-		vgpu.position = voxel.position;
+		vgpu.x = (uint16_t)(((int)voxel.position.x - m_origin.x) / m_step);
+		vgpu.y = (uint16_t)(((int)voxel.position.y - m_origin.y) / m_step);
+		vgpu.z = (uint16_t)(((int)voxel.position.z - m_origin.z) / m_step);
+		vgpu.setColor(voxel.color);
 
-		glm::vec3 scale = glm::vec3(m_step);
-		glm::mat4 model0 = glm::mat4(1.0f);
-		model0 = glm::scale(model0, scale);
+		return vgpu;
+	}
 
-		vgpu.model = glm::translate(model0, voxel.position / scale);
+	/*
+	 * Only flags the instance for upload if its packed color changed,
+	 * so the label colors that stay the same are not uploaded every frame
+	 */
+	void VoxelReconstruction::setVoxelColor(Voxel* voxel, const glm::vec3& color)
+	{
+		voxel->color = color;
+		if (voxel->surfaceIndex < 0)
+			return;
 
-		return vgpu;
+		VoxelGPU& vgpu = m_surface_voxels_gpu[voxel->surfaceIndex];
+		const uint16_t previous = vgpu.color;
+		vgpu.setColor(color);
+		if (vgpu.color != previous)
+			m_surface_voxels_dirty[voxel->surfaceIndex] = 1;
+	}
+
+	/*
+	 * Extract the surface of the visible voxels, per person if MESH_PER_PERSON, and queue it for writing
+	 */
+	void VoxelReconstruction::exportMeshes()
+	{
+		TRACE_SCOPE("exportMeshes");
+		static std::vector<PlyColor> colors
+		{
+			{255,0,0},		// red
+			{0,255,0},		// green
+			{0,0,255},		// blue
+			{255,0,255}		// purple
+		};
+
+		m_mesh_extractor.fill(m_visible_voxels, m_labels, m_assignment);
+
+		std::ostringstream frame;
+		frame << std::setw(5) << std::setfill('0') << m_frame_nr;
+		const std::string path = util::DATA_DIR_STR + util::MESH_FILE + "_" + frame.str();
+
+		// All meshes come from one pass over the grid
+		std::vector<PlyMesh> meshes;
+		m_mesh_extractor.extract(meshes);
+		for (int i = 0; i < meshes.size(); i++)
+		{
+			if (util::MESH_PER_PERSON)
+			{
+				meshes[i].colors.assign(meshes[i].vertices.size(), colors[i]);
+				m_ply_writer.write(path + "_" + std::to_string(i) + ".ply", std::move(meshes[i]));
+			}
+			else
+			{
+				m_ply_writer.write(path + ".ply", std::move(meshes[i]));
+			}
+		}
+		DEBUG("Queued the meshes of frame {}", m_frame_nr);
 	}
 } /* namespace team45 */
\ No newline at end of file
@@ -10,6 +10,9 @@
 #include "scene_camera.h"
 #include "cube.h"
 #include "voxel_buffer.h"
+#include "track_buffer.h"
+#include "frame_worker.h"
+#include "tracer.h"
 
 namespace team45
 {
@@ -17,6 +20,9 @@ namespace team45
 
 	Window::~Window()
 	{
+		delete m_worker;
+		m_worker = nullptr;
+
 		delete m_scene_camera;
 		m_scene_camera = nullptr;
 
@@ -33,6 +39,11 @@ namespace team45
 		m_volume_vb = nullptr;
 		delete m_cube_vb;
 		m_cube_vb = nullptr;
+		delete m_voxel_buffer;
+		m_voxel_buffer = nullptr;
+		for (auto buffer : m_track_buffers)
+			delete buffer;
+		m_track_buffers.clear();
 
 		glfwDestroyWindow(m_glfwWindow);
 		glfwTerminate();
@@ -60,6 +71,8 @@ namespace team45
 		}
 		glfwSetWindowUserPointer(m_glfwWindow, this);
 		glfwMakeContextCurrent(m_glfwWindow);
+		// Draw at display rate, the frames are processed by the worker independently
+		glfwSwapInterval(1);
 
 		// Load OpenGL extensions
 		if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
@@ -119,15 +132,26 @@ namespace team45
 		m_voxel_buffer = new VoxelBuffer();
 		m_voxel_buffer->Create(s3d.getReconstructor().getVoxels().size());
 
+		// Create a buffer per person for the tracks, they grow with the recording
+		for (int i = 0; i < s3d.getReconstructor().get2dTracking().size(); i++)
+		{
+			m_track_buffers.push_back(new TrackBuffer());
+			m_track_buffers[i]->SetName("Track " + std::to_string(i));
+			m_track_buffers[i]->Create(util::TRACK_BUFFER_CAPACITY);
+		}
+
+		m_worker = new FrameWorker();
+
 		return true;
 	}
 
 	/**
-	 * This loop updates and displays the scene every iteration
+	 * This loop displays the scene every iteration, the frames are processed by the worker in the meantime
 	 */
 	void Window::run()
 	{
 		static float currentTime = 0, previousTime = 0;
+		m_worker->start(*m_scene3d);
 		while (!glfwWindowShouldClose(m_glfwWindow))
 		{
 			currentTime = glfwGetTime();
@@ -140,10 +164,12 @@ namespace team45
 			glfwSwapBuffers(m_glfwWindow);
 			glfwPollEvents();
 		}
+		// The reconstruction is destroyed after run returns
+		m_worker->stop();
 	}
 	/**
-	 * - Update the scene with a new frame from the video
-	 * - Handle the keyboard input from the OpenCV window
+	 * - Handle the keyboard input, the commands for the reconstruction go to the worker
+	 * - Upload the latest snapshot of the worker
 	 * - Update the OpenCV video window and frames slider position
 	 */
 	void Window::update()
@@ -153,8 +179,6 @@ namespace team45
 			WINDOW.m_scene_camera->RotateAroundPoint(glm::vec3(0.f, 0.f, 500.f), 5000, -0.5f);
 		}
 
-		Scene3DRenderer& scene3d = WINDOW.getScene3d();
-
 		if (!m_rotate_camera)
 		{
 			if (isKeyRepeat(GLFW_KEY_W)) WINDOW.m_scene_camera->Move(Direction::Forward, WINDOW.m_deltaTime);
@@ -165,84 +189,56 @@ namespace team45
 		if (isKeyRepeat(GLFW_KEY_LEFT_CONTROL))  WINDOW.m_scene_camera->Move(Direction::Down, WINDOW.m_deltaTime);
 		if (isKeyRepeat(GLFW_KEY_SPACE))  WINDOW.m_scene_camera->Move(Direction::Up, WINDOW.m_deltaTime);
 
-		if (isKeyPressed(GLFW_KEY_P)) WINDOW.m_paused = !WINDOW.m_paused;
-		if (isKeyPressed(GLFW_KEY_B)) scene3d.setCurrentFrame(scene3d.getCurrentFrame() - 1);
-		if (isKeyPressed(GLFW_KEY_N)) scene3d.setCurrentFrame(scene3d.getCurrentFrame() + 1);
+		if (isKeyPressed(GLFW_KEY_P)) m_worker->push(Command::TogglePause);
+		if (isKeyPressed(GLFW_KEY_B)) m_worker->push(Command::PreviousFrame);
+		if (isKeyPressed(GLFW_KEY_N)) m_worker->push(Command::NextFrame);
 		if (isKeyPressed(GLFW_KEY_R))
 		{
 			WINDOW.m_rotate_camera = !WINDOW.m_rotate_camera;
 			WINDOW.m_scene_camera->Reset(WINDOW.m_rotate_camera);
 		}
-		if (isKeyPressed(GLFW_KEY_C))
-		{
-			// Save the 2D tracking points
-			scene3d.getReconstructor().smooth2dTracking();
-			scene3d.getReconstructor().save2dTracking();
-		}
+		if (isKeyPressed(GLFW_KEY_C)) m_worker->push(Command::SaveTracking);
 		if (isKeyPressed(GLFW_KEY_V))
 		{
 			m_draw_voxels = !m_draw_voxels;
 		}
-
-		if (scene3d.getCurrentFrame() > scene3d.getNumberOfFrames() - 2)
-		{
-			// Save the 2D tracking points
-			scene3d.getReconstructor().smooth2dTracking();
-			scene3d.getReconstructor().save2dTracking();
-
-			// Go to the start of the video if we've moved beyond the end
-			scene3d.setCurrentFrame(0);
-			for (size_t c = 0; c < scene3d.getCameras().size(); ++c)
-				scene3d.getCameras()[c]->setVideoFrame(scene3d.getCurrentFrame());
-		}
-		if (scene3d.getCurrentFrame() < 0)
-		{
-			// Go to the end of the video if we've moved before the start
-			scene3d.setCurrentFrame(scene3d.getNumberOfFrames() - 2);
-			for (size_t c = 0; c < scene3d.getCameras().size(); ++c)
-				scene3d.getCameras()[c]->setVideoFrame(scene3d.getCurrentFrame());
-		}
-		if (!m_paused)
-		{
-			// If not paused move to the next frame
-			scene3d.setCurrentFrame(scene3d.getCurrentFrame() + 1);
-		}
-		if (scene3d.getCurrentFrame() != scene3d.getPreviousFrame())
+		if (isKeyPressed(GLFW_KEY_K)) m_worker->push(Command::ToggleClusterMode);
+		if (isKeyPressed(GLFW_KEY_M)) m_worker->push(Command::LogMemory);
+		if (isKeyPressed(GLFW_KEY_U)) m_worker->push(Command::LogUtilization);
+		if (isKeyPressed(GLFW_KEY_T)) m_worker->push(Command::ToggleColorMode);
+		if (isKeyPressed(GLFW_KEY_O)) m_worker->push(Command::ToggleVisibility);
+		if (isKeyPressed(GLFW_KEY_E)) m_worker->push(Command::ExportMeshes);
+		if (isKeyPressed(GLFW_KEY_X)) m_worker->push(Command::ToggleMeshStreaming);
+
+		// A dragged frame slider seeks
+		int trackbarPos = cv::getTrackbarPos("Frame", util::VIDEO_WINDOW);
+		if (trackbarPos != m_trackbar_pos)
 		{
-			// If the current frame is different from the last iteration update stuff
-			scene3d.processFrame();
-			scene3d.getReconstructor().update();
-			scene3d.setPreviousFrame(scene3d.getCurrentFrame());
+			m_trackbar_pos = trackbarPos;
+			m_worker->push(Command::Seek, trackbarPos);
 		}
 
-		// Get the image and the foreground image (of set camera)
-		cv::Mat canvas, foreground;
-		if (scene3d.getCurrentCamera() != -1)
-		{
-			canvas = scene3d.getCameras()[scene3d.getCurrentCamera()]->getFrame();
-			foreground = scene3d.getCameras()[scene3d.getCurrentCamera()]->getForegroundImage();
-		}
-		else
+		int frame = -1;
+		bool fresh = m_worker->consume([&](FrameSnapshot& snapshot)
 		{
-			canvas = scene3d.getCameras()[scene3d.getPreviousCamera()]->getFrame();
-			foreground = scene3d.getCameras()[scene3d.getPreviousCamera()]->getForegroundImage();
-		}
+			TRACE_SCOPE("upload");
+			// Only uploads the instances that changed since the last snapshot
+			m_voxel_buffer->Update(snapshot.voxels, snapshot.dirty);
+			// Only the positions of the new frames are uploaded
+			for (int i = 0; i < snapshot.tracks.size(); i++)
+				m_track_buffers[i]->Sync(snapshot.tracks[i]);
+			snapshot.canvas.copyTo(m_canvas);
+			frame = snapshot.frame;
+		});
+		if (!fresh)
+			return;
 
-		// Concatenate the video frame with the foreground image (of set camera)
-		if (!canvas.empty() && !foreground.empty())
-		{
-			cv::Mat fg_im_3c;
-			cvtColor(foreground, fg_im_3c, CV_GRAY2BGR);
-			hconcat(canvas, fg_im_3c, canvas);
-			imshow(util::VIDEO_WINDOW, canvas);
-		}
-		else if (!canvas.empty())
-		{
-			imshow(util::VIDEO_WINDOW, canvas);
-		}
+		if (!m_canvas.empty())
+			imshow(util::VIDEO_WINDOW, m_canvas);
 
 		// Update the frame slider position
-		cv::setTrackbarPos("Frame", util::VIDEO_WINDOW, scene3d.getCurrentFrame());
+		m_trackbar_pos = frame;
+		cv::setTrackbarPos("Frame", util::VIDEO_WINDOW, frame);
 	}
 
 	/**
@@ -250,11 +246,10 @@ namespace team45
 	 */
 	void Window::draw()
 	{
+		TRACE_SCOPE("draw");
 		glClearColor(m_clear_color.r, m_clear_color.g, m_clear_color.b, m_clear_color.a);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		Scene3DRenderer& scene3d = WINDOW.getScene3d();
-
 		m_basic_shader->Begin();
 		// Set camera matrices
 		auto projectionView = m_scene_camera->GetProjMatrix() * m_scene_camera->GetViewMatrix();
@@ -300,37 +295,31 @@ namespace team45
 	}
 
 	/**
-	 * Draw all visible voxels
+	 * Draw the visible voxels on the surface of the blobs
 	 */
 	void Window::drawVoxels()
 	{
 		
-		std::vector<VoxelGPU> voxels = m_scene3d->getReconstructor().getVisibleVoxelsGPU();
-		int size = WINDOW.m_scene3d->getReconstructor().getStep();
+		auto& reconstructor = m_scene3d->getReconstructor();
 		auto projectionView = m_scene_camera->GetProjMatrix() * m_scene_camera->GetViewMatrix();
 
 		m_voxel_shader->Begin();
 		// Set camera matrices
 		m_voxel_shader->SetMat4("u_ProjectionView", projectionView);
+		// Grid to world transform
+		m_voxel_shader->SetVec3("u_Origin", glm::vec3(reconstructor.getOrigin()));
+		m_voxel_shader->SetFloat("u_Step", (float)reconstructor.getStep());
 		// Draw voxels
-		m_voxel_buffer->Draw(voxels);
+		m_voxel_buffer->Draw();
 		
 		m_voxel_shader->End();
 	}
 
 	void Window::draw2dTracks()
 	{
-		auto tracks = m_scene3d->getReconstructor().get2dTracking();
-		auto projectionView = m_scene_camera->GetProjMatrix() * m_scene_camera->GetViewMatrix();
-
-		for (int i = 0; i < tracks.size(); i++)
-		{
-			VertexBuffer points;
-			points.Create(tracks[i]);
-			points.Bind();
-			points.Draw(GL_POINTS);
-			points.Unbind();
-		}
+		// Synced with the worker's snapshot in update
+		for (auto buffer : m_track_buffers)
+			buffer->Draw(GL_POINTS);
 	}
 
 	bool Window::isKeyRepeat(int key)
@@ -352,7 +341,7 @@ namespace team45
 		int num = key - GLFW_KEY_1;
 		if (num >= 0 && num < (int)scene3d.getCameras().size())
 		{
-			scene3d.toggleCamera(num);
+			WINDOW.m_worker->push(Command::ToggleCamera, num);
 		}
 	}
 
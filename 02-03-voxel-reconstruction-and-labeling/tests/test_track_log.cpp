@@ -0,0 +1,113 @@
+#include "cvpch.h"
+#include "track_log.h"
+
+using namespace team45;
+
+/*
+ * Round trip of the binary track log: the records of two runs that append to the same log,
+ * one of them jumping back in playback, are found again through the index
+ */
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	if (!(condition)) { ERROR("Check failed: {}", #condition); failures++; }
+
+namespace
+{
+	const int PERSONS = 4;
+	const int INTERVAL = 8;
+
+	/*
+	 * @param pass Stored in y, tells which pass over the frame a record was written by
+	 */
+	void appendFrames(TrackLogWriter& writer, int first, int last, float pass)
+	{
+		for (int frame = first; frame <= last; frame++)
+		{
+			std::array<TrackRecord, PERSONS> records;
+			for (int p = 0; p < PERSONS; p++)
+				records[p] = { frame, (int16_t)p, 0, frame * 10.f + p, pass, 0, 0 };
+			writer.append(records.data(), records.size());
+		}
+	}
+
+	void checkFrame(const TrackLogReader& reader, int frame, float pass)
+	{
+		const TrackRecord* record = reader.findFrame(frame);
+		CHECK(record != reader.end());
+		if (record == reader.end())
+			return;
+
+		for (int p = 0; p < PERSONS; p++, record++)
+		{
+			CHECK(record != reader.end());
+			if (record == reader.end())
+				return;
+			CHECK(record->frame == frame && record->person == p);
+			CHECK(record->x == frame * 10.f + p && record->y == pass);
+		}
+	}
+
+	void checkLog(const std::string& path)
+	{
+		TrackLogReader reader;
+		CHECK(reader.open(path));
+		CHECK(reader.size() == (40 + 20 + 25) * PERSONS);
+		CHECK(reader.getHeader().persons == PERSONS);
+
+		checkFrame(reader, 0, 2);		// Second run
+		checkFrame(reader, 20, 2);
+		checkFrame(reader, 24, 2);
+		checkFrame(reader, 27, 1);		// First run, only the first pass got there
+		checkFrame(reader, 29, 1);
+		checkFrame(reader, 30, 1.5f);	// First run, after jumping back
+		checkFrame(reader, 45, 1.5f);
+		checkFrame(reader, 49, 1.5f);
+		CHECK(reader.findFrame(50) == reader.end());
+		CHECK(reader.findFrame(-1) == reader.end());
+	}
+}
+
+int main(int argc, char** argv)
+{
+	log::init();
+	const std::string path = (std::filesystem::temp_directory_path() / "test_track_log.bin").string();
+	std::filesystem::remove(path);
+	std::filesystem::remove(path + ".idx");
+
+	{
+		TrackLogWriter writer;
+		CHECK(writer.open(path, PERSONS, INTERVAL));
+		appendFrames(writer, 0, 39, 1);
+		appendFrames(writer, 30, 49, 1.5f);
+	}
+
+	// A run that died while writing leaves a partial record, the next run cuts it off
+	{
+		std::ofstream log(path, std::ios::binary | std::ios::app);
+		log.write("partial", 7);
+	}
+
+	{
+		TrackLogWriter writer;
+		CHECK(!writer.open(path, PERSONS + 1, INTERVAL));
+		CHECK(writer.open(path, PERSONS, INTERVAL));
+		appendFrames(writer, 0, 24, 2);
+	}
+
+	checkLog(path);
+
+	// Without the index file the reader builds the index itself
+	std::filesystem::remove(path + ".idx");
+	checkLog(path);
+
+	std::filesystem::remove(path);
+	std::filesystem::remove(path + ".idx");
+	if (failures > 0)
+		ERROR("{} checks failed", failures);
+	else
+		INFO("All checks passed");
+	log::shutdown();
+	return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
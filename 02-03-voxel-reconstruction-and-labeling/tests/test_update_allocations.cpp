@@ -0,0 +1,115 @@
+#include "cvpch.h"
+#include "util.h"
+#include "voxel_camera.h"
+#include "voxel_reconstruction.h"
+#include "task_pool.h"
+#include "alloc_counter.h"
+
+using namespace team45;
+
+/*
+ * Steady-state VoxelReconstruction::update() on the 4persons recording makes no heap allocations,
+ * neither through operator new nor for cv::Mat buffers, in every cluster mode.
+ * Only the update thread is counted, the work it hands to the task pool runs on the workers.
+ */
+
+// ctest reports the test as skipped instead of failed, see SKIP_RETURN_CODE in CMakeLists.txt
+static const int SKIPPED = 77;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	if (!(condition)) { ERROR("Check failed: {}", #condition); failures++; }
+
+namespace
+{
+	const int CAMERAS = 4;
+	const int VOXEL_HEIGHT = 2048 + 1024;
+	const int VOXEL_STEP = 64;
+	const int CHECKED_FRAMES = 25;		// Per cluster mode
+
+	void processFrame(const std::vector<VoxelCamera*>& cameras)
+	{
+		for (auto camera : cameras)
+		{
+			camera->advanceVideoFrame();
+			camera->createForegroundImage();
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	log::init();
+	// The DEBUG lines of a frame are formatted on the heap, so they are left out
+	spdlog::set_level(spdlog::level::info);
+	alloc_counter::init();
+	TaskPool::get().init({ util::TASK_POOL_THREADS, util::TASK_POOL_PIN });
+
+	if (!alloc_counter::enabled())
+	{
+		ERROR("Built without TEAM45_ALLOC_COUNTER, nothing is counted");
+		return EXIT_FAILURE;
+	}
+
+	// Both kinds of allocations have to show up, or a zero count means nothing
+	{
+		const size_t before = alloc_counter::count();
+		std::vector<int> vector(16);
+		cv::Mat mat(16, 16, CV_8U);
+		CHECK(alloc_counter::count() - before >= 2);
+	}
+
+	// The cameras of the 4persons recording, set up like main.cpp does
+	std::vector<VoxelCamera*> cameras;
+	for (int c = 0; c < CAMERAS; c++)
+	{
+		const std::string path = util::DATA_DIR_STR + "4persons/cam" + std::to_string(c + 1) + PATH_SEP;
+		if (!util::fexists(path + util::VIDEO_FILE))
+		{
+			WARN("No {} in {}, skipping", util::VIDEO_FILE, path);
+			return SKIPPED;
+		}
+		cameras.push_back(new VoxelCamera(path, c));
+		CHECK(cameras.back()->initialize());
+	}
+
+	{
+		VoxelReconstruction reconstructor(cameras, VOXEL_HEIGHT, VOXEL_STEP);
+		int frame = 0;
+
+		// Every cluster mode grows its own buffers, so each gets the warmup frames before it is checked
+		const ClusterMode modes[] = { ClusterMode::WarmStart, ClusterMode::FloorGrid, ClusterMode::Restart };
+		for (ClusterMode mode : modes)
+		{
+			while (reconstructor.getClusterMode() != mode)
+				reconstructor.toggleClusterMode();
+
+			for (int f = 0; f < util::K_ALLOC_WARMUP_FRAMES + CHECKED_FRAMES; f++, frame++)
+			{
+				processFrame(cameras);
+				const size_t before = alloc_counter::count();
+				reconstructor.update(frame);
+				const size_t allocated = alloc_counter::count() - before;
+
+				if (f >= util::K_ALLOC_WARMUP_FRAMES && allocated > 0)
+				{
+					ERROR("Frame {} ({}) made {} heap allocations", frame, clusterModeName(mode), allocated);
+					failures++;
+				}
+			}
+			INFO("Checked {} frames with {}", CHECKED_FRAMES, clusterModeName(mode));
+		}
+	}
+
+	for (auto camera : cameras)
+		delete camera;
+	TaskPool::get().shutdown();
+
+	if (failures > 0)
+		ERROR("{} checks failed", failures);
+	else
+		INFO("All checks passed");
+	log::shutdown();
+	return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+#include "cvpch.h"
+#include "alloc_counter.h"
+
+namespace team45
+{
+	namespace
+	{
+		thread_local size_t t_allocations = 0;
+
+#ifdef TEAM45_ALLOC_COUNTER
+		// OpenCV allocates the Mat buffers with fastMalloc instead of operator new
+		class CountingMatAllocator : public cv::MatAllocator
+		{
+		public:
+			cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+				cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override
+			{
+				t_allocations++;
+				return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+			}
+
+			bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override
+			{
+				return cv::Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+			}
+
+			// The buffers belong to the standard allocator, so they are freed by it
+			void deallocate(cv::UMatData* data) const override
+			{
+				cv::Mat::getStdAllocator()->deallocate(data);
+			}
+		};
+#endif
+	}
+
+	void alloc_counter::init()
+	{
+#ifdef TEAM45_ALLOC_COUNTER
+		static CountingMatAllocator allocator;
+		cv::Mat::setDefaultAllocator(&allocator);
+#endif
+	}
+
+	bool alloc_counter::enabled()
+	{
+#ifdef TEAM45_ALLOC_COUNTER
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	size_t alloc_counter::count()
+	{
+		return t_allocations;
+	}
+
+#ifdef TEAM45_ALLOC_COUNTER
+	namespace
+	{
+		void* countedAlloc(size_t size)
+		{
+			t_allocations++;
+			if (void* p = std::malloc(size == 0 ? 1 : size))
+				return p;
+			throw std::bad_alloc();
+		}
+
+		void* countedAlignedAlloc(size_t size, std::align_val_t alignment)
+		{
+			t_allocations++;
+			size_t align = (size_t)alignment;
+			size = (size + align - 1) / align * align;
+#ifdef _WIN32
+			void* p = _aligned_malloc(size == 0 ? align : size, align);
+#else
+			void* p = std::aligned_alloc(align, size == 0 ? align : size);
+#endif
+			if (p) return p;
+			throw std::bad_alloc();
+		}
+
+		void alignedFree(void* p)
+		{
+#ifdef _WIN32
+			_aligned_free(p);
+#else
+			std::free(p);
+#endif
+		}
+	}
+#endif
+}
+
+#ifdef TEAM45_ALLOC_COUNTER
+// Replacements of the global allocation functions, all other forms forward to these
+void* operator new(size_t size) { return team45::countedAlloc(size); }
+void* operator new[](size_t size) { return team45::countedAlloc(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return team45::countedAlignedAlloc(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return team45::countedAlignedAlloc(size, alignment); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { team45::alignedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { team45::alignedFree(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { team45::alignedFree(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { team45::alignedFree(p); }
+#endif
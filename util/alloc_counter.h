@@ -0,0 +1,20 @@
+#pragma once
+
+namespace team45
+{
+	/*
+	 * Counts the heap allocations made through operator new, and the cv::Mat buffers once init() ran
+	 * Only counts when compiled with cmake -DENABLE_ALLOC_COUNTER=ON, which replaces the global operator new
+	 * and the default cv::Mat allocator.
+	 * Every thread has its own count, so the render, task pool and writer threads don't show up in the update thread's.
+	 */
+	namespace alloc_counter
+	{
+		// Counts the cv::Mat buffers as well, call it before the Mats to count are created
+		void init();
+		bool enabled();
+
+		// Number of allocations the calling thread made since it started
+		size_t count();
+	};
+}
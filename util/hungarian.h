@@ -0,0 +1,101 @@
+#pragma once
+#ifndef HUNGARIAN_H
+#define HUNGARIAN_H
+
+namespace util
+{
+	/**
+	 * Solves the square assignment problem in O(n^3) with the Hungarian algorithm
+	 * (shortest augmenting paths with potentials, as in Jonker-Volgenant)
+	 * https://cp-algorithms.com/graph/hungarian-algorithm.html
+	 *
+	 * @param cost n x n matrix, cost[i][j] is the cost of assigning row i to column j
+	 * @param outAssignment For every row the column it's assigned to
+	 * @param outCost Sum of the costs of the chosen assignment
+	 * @param memory Resource for the working memory, e.g. a per-frame arena
+	 */
+	template <typename Matrix, typename Assignment>
+	static void hungarian(const Matrix& cost, Assignment& outAssignment, float& outCost,
+		std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+	{
+		const int n = (int)cost.size();
+		const double inf = std::numeric_limits<double>::infinity();
+
+		// 1-based, index 0 is a virtual row/column used as the start of each augmenting path
+		std::pmr::vector<double> u(n + 1, 0, memory), v(n + 1, 0, memory), minv(n + 1, inf, memory);
+		std::pmr::vector<int> rowOfCol(n + 1, 0, memory), way(n + 1, 0, memory);
+		std::pmr::vector<char> used(n + 1, 0, memory);
+
+		for (int i = 1; i <= n; i++)
+		{
+			rowOfCol[0] = i;
+			int j0 = 0;
+			std::fill(minv.begin(), minv.end(), inf);
+			std::fill(used.begin(), used.end(), 0);
+
+			// Grow the alternating tree until it reaches a free column
+			do
+			{
+				used[j0] = true;
+				int i0 = rowOfCol[j0], j1 = 0;
+				double delta = inf;
+				for (int j = 1; j <= n; j++)
+				{
+					if (used[j]) continue;
+					double reduced = cost[i0 - 1][j - 1] - u[i0] - v[j];
+					if (reduced < minv[j])
+					{
+						minv[j] = reduced;
+						way[j] = j0;
+					}
+					if (minv[j] < delta)
+					{
+						delta = minv[j];
+						j1 = j;
+					}
+				}
+				for (int j = 0; j <= n; j++)
+				{
+					if (used[j])
+					{
+						u[rowOfCol[j]] += delta;
+						v[j] -= delta;
+					}
+					else
+					{
+						minv[j] -= delta;
+					}
+				}
+				j0 = j1;
+			} while (rowOfCol[j0] != 0);
+
+			// Flip the augmenting path
+			do
+			{
+				int j1 = way[j0];
+				rowOfCol[j0] = rowOfCol[j1];
+				j0 = j1;
+			} while (j0 != 0);
+		}
+
+		outAssignment.assign(n, -1);
+		outCost = 0;
+		for (int j = 1; j <= n; j++)
+		{
+			outAssignment[rowOfCol[j] - 1] = j - 1;
+			outCost += cost[rowOfCol[j] - 1][j - 1];
+		}
+	}
+
+	/**
+	 * @return For every row the column it's assigned to
+	 */
+	static std::vector<int> hungarian(const std::vector<std::vector<float>>& cost, float& outCost)
+	{
+		std::vector<int> colOfRow;
+		hungarian(cost, colOfRow, outCost);
+		return colOfRow;
+	}
+} /* namespace util */
+
+#endif /* HUNGARIAN_H */
@@ -0,0 +1,90 @@
+#pragma once
+#ifndef KMEANS_H
+#define KMEANS_H
+
+#include "task_pool.h"
+
+namespace util
+{
+	/**
+	 * Mini-batch k-means (Sculley, "Web-scale k-means clustering", 2010)
+	 * Seeds the centers with k-means++, then moves them towards the samples of small random batches.
+	 * Every center has its own learning rate, 1 / the number of samples it has absorbed so far.
+	 * Cost per iteration only depends on the batch size, not on the number of samples.
+	 *
+	 * @param samples Points to cluster, at least k
+	 * @param seed Same seed and samples give the same centers, regardless of the number of threads
+	 * @return The k centers
+	 */
+	static std::vector<cv::Point3f> miniBatchKmeans(const std::vector<cv::Point3f>& samples, int k, int batchSize, int iterations, unsigned seed)
+	{
+		const int n = (int)samples.size();
+		std::mt19937 rng(seed);
+		std::vector<cv::Point3f> centers;
+		centers.reserve(k);
+
+		// k-means++, every next center is picked with a probability proportional to its squared distance to the closest center
+		std::vector<float> distances(n, FLT_MAX);
+		centers.push_back(samples[std::uniform_int_distribution<int>(0, n - 1)(rng)]);
+		while (centers.size() < k)
+		{
+			const cv::Point3f last = centers.back();
+			double total = team45::TaskPool::get().parallelSum(0, n, 4096, 0.0, [&](int begin, int end)
+			{
+				double partial = 0;
+				for (int i = begin; i < end; i++)
+				{
+					cv::Point3f d = samples[i] - last;
+					distances[i] = std::min(distances[i], d.dot(d));
+					partial += distances[i];
+				}
+				return partial;
+			});
+
+			double target = std::uniform_real_distribution<double>(0, total)(rng);
+			int pick = 0;
+			for (; pick < n - 1; pick++)
+			{
+				target -= distances[pick];
+				if (target <= 0) break;
+			}
+			centers.push_back(samples[pick]);
+		}
+
+		std::vector<int> batch(batchSize), nearest(batchSize), counts(k, 0);
+		std::uniform_int_distribution<int> sample(0, n - 1);
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			for (auto& b : batch)
+				b = sample(rng);
+
+			// Assign the batch to the current centers
+			team45::TaskPool::get().parallelFor(0, batchSize, 256, [&](int b)
+			{
+				float shortestDist = FLT_MAX;
+				for (int c = 0; c < k; c++)
+				{
+					cv::Point3f d = samples[batch[b]] - centers[c];
+					float distance = d.dot(d);
+					if (distance < shortestDist)
+					{
+						shortestDist = distance;
+						nearest[b] = c;
+					}
+				}
+			});
+
+			// Gradient step, in batch order so the result does not depend on the threads
+			for (int b = 0; b < batchSize; b++)
+			{
+				int c = nearest[b];
+				float eta = 1.f / ++counts[c];
+				centers[c] = centers[c] * (1.f - eta) + samples[batch[b]] * eta;
+			}
+		}
+
+		return centers;
+	}
+} /* namespace util */
+
+#endif /* KMEANS_H */
@@ -0,0 +1,56 @@
+#include "cvpch.h"
+#include "memory_report.h"
+
+#ifdef _WIN32
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+namespace team45
+{
+	void MemoryReport::add(const std::string& name, size_t bytes)
+	{
+		m_entries.push_back({ name, bytes });
+	}
+
+	size_t MemoryReport::total() const
+	{
+		size_t sum = 0;
+		for (auto& e : m_entries)
+			sum += e.second;
+		return sum;
+	}
+
+	void MemoryReport::log(const std::string& title) const
+	{
+		const double mb = 1024.0 * 1024.0;
+		std::ostringstream stream;
+		stream << std::fixed << std::setprecision(2);
+		for (auto& e : m_entries)
+			stream << "  " << std::left << std::setw(32) << e.first << std::right << std::setw(10) << e.second / mb << " MB\n";
+		stream << "  " << std::left << std::setw(32) << "Total accounted" << std::right << std::setw(10) << total() / mb << " MB\n";
+		stream << "  " << std::left << std::setw(32) << "Peak RSS" << std::right << std::setw(10) << peakRss() / mb << " MB";
+		INFO("{}\n{}", title, stream.str());
+	}
+
+	size_t MemoryReport::peakRss()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return counters.PeakWorkingSetSize;
+		return 0;
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+			return 0;
+#ifdef __APPLE__
+		return (size_t)usage.ru_maxrss;			// bytes
+#else
+		return (size_t)usage.ru_maxrss * 1024;	// kilobytes
+#endif
+#endif
+	}
+}
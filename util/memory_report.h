@@ -0,0 +1,35 @@
+#pragma once
+
+namespace team45
+{
+	/*
+	 * Byte counts of named data structures, so memory growth can be attributed to a structure
+	 * Containers are counted by capacity, as that is what they actually hold on to
+	 */
+	class MemoryReport
+	{
+	public:
+		void add(const std::string& name, size_t bytes);
+		size_t total() const;
+		void log(const std::string& title) const;
+
+		/*
+		 * @return Peak resident set size of this process in bytes (0 if unavailable)
+		 */
+		static size_t peakRss();
+
+		template <typename T>
+		static size_t bytes(const std::vector<T>& v)
+		{
+			return v.capacity() * sizeof(T);
+		}
+
+		static size_t bytes(const cv::Mat& m)
+		{
+			return m.empty() ? 0 : m.total() * m.elemSize();
+		}
+
+	private:
+		std::vector<std::pair<std::string, size_t>> m_entries;
+	};
+}
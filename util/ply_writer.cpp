@@ -0,0 +1,143 @@
+#include "cvpch.h"
+#include "ply_writer.h"
+#include "tracer.h"
+
+namespace team45
+{
+	namespace
+	{
+		// Meshes waiting for the disk before write() starts warning
+		const size_t PLY_QUEUE_WARNING = 32;
+	}
+
+	PlyWriter::~PlyWriter()
+	{
+		stop();
+	}
+
+	void PlyWriter::start()
+	{
+		if (isRunning())
+			return;
+		m_stop = false;
+		m_thread = std::thread(&PlyWriter::run, this);
+	}
+
+	/*
+	 * Writes everything that is still queued before returning
+	 */
+	void PlyWriter::stop()
+	{
+		if (!m_thread.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_condition.notify_one();
+		m_thread.join();
+	}
+
+	void PlyWriter::write(const std::string& path, PlyMesh&& mesh)
+	{
+		size_t queued;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_queue.emplace_back(path, std::move(mesh));
+			queued = m_queue.size();
+		}
+		m_condition.notify_one();
+		if (queued == PLY_QUEUE_WARNING)
+			WARN("{} meshes are waiting to be written, the disk can't keep up", queued);
+	}
+
+	void PlyWriter::run()
+	{
+		if (tracer::enabled())
+			tracer::setThreadName("PLY writer");
+		while (true)
+		{
+			std::pair<std::string, PlyMesh> job;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_condition.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+				if (m_queue.empty() && m_stop)
+					return;
+				job = std::move(m_queue.front());
+				m_queue.pop_front();
+			}
+			writeFile(job.first, job.second);
+		}
+	}
+
+	/*
+	 * Assumes a little endian host, like every platform this project builds on
+	 */
+	bool PlyWriter::writeFile(const std::string& path, const PlyMesh& mesh)
+	{
+		TRACE_SCOPE("writePly");
+		std::FILE* file = std::fopen(path.c_str(), "wb");
+		if (file == nullptr)
+		{
+			ERROR("Unable to write mesh to {}", path);
+			return false;
+		}
+
+		const bool colored = !mesh.colors.empty();
+		assert(!colored || mesh.colors.size() == mesh.vertices.size());
+
+		std::ostringstream header;
+		header << "ply\n"
+			<< "format binary_little_endian 1.0\n"
+			<< "element vertex " << mesh.vertices.size() << "\n"
+			<< "property float x\nproperty float y\nproperty float z\n";
+		if (colored)
+			header << "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+		header << "element face " << mesh.quads.size() << "\n"
+			<< "property list uchar int vertex_indices\n"
+			<< "end_header\n";
+		const std::string text = header.str();
+		std::fwrite(text.data(), 1, text.size(), file);
+
+		// Interleave the vertex properties, and write in blocks to keep the fwrite calls few
+		const size_t vertexSize = sizeof(glm::vec3) + (colored ? sizeof(PlyColor) : 0);
+		const size_t faceSize = 1 + sizeof(glm::ivec4);
+		std::vector<char> block;
+		block.reserve(std::max(vertexSize, faceSize) * 4096);
+
+		for (size_t v = 0; v < mesh.vertices.size(); v++)
+		{
+			const char* position = reinterpret_cast<const char*>(&mesh.vertices[v]);
+			block.insert(block.end(), position, position + sizeof(glm::vec3));
+			if (colored)
+			{
+				const char* color = reinterpret_cast<const char*>(&mesh.colors[v]);
+				block.insert(block.end(), color, color + sizeof(PlyColor));
+			}
+			if (block.size() + vertexSize > block.capacity())
+			{
+				std::fwrite(block.data(), 1, block.size(), file);
+				block.clear();
+			}
+		}
+
+		for (auto& quad : mesh.quads)
+		{
+			const char* indices = reinterpret_cast<const char*>(&quad);
+			block.push_back(4);
+			block.insert(block.end(), indices, indices + sizeof(glm::ivec4));
+			if (block.size() + faceSize > block.capacity())
+			{
+				std::fwrite(block.data(), 1, block.size(), file);
+				block.clear();
+			}
+		}
+		std::fwrite(block.data(), 1, block.size(), file);
+
+		const bool ok = std::ferror(file) == 0;
+		std::fclose(file);
+		if (!ok)
+			ERROR("Failed writing mesh to {}", path);
+		return ok;
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+namespace team45
+{
+	struct PlyColor
+	{
+		uint8_t r, g, b;
+	};
+
+	/*
+	 * Quad mesh as written to a PLY file
+	 */
+	struct PlyMesh
+	{
+		std::vector<glm::vec3> vertices;
+		std::vector<PlyColor> colors;		// Empty, or one per vertex
+		std::vector<glm::ivec4> quads;		// Vertex indices, counter-clockwise seen from outside
+
+		void clear()
+		{
+			vertices.clear();
+			colors.clear();
+			quads.clear();
+		}
+	};
+
+	/*
+	 * Writes meshes as binary little endian PLY files on a background thread
+	 * write() only moves the mesh into the queue, so the caller never waits for the disk
+	 */
+	class PlyWriter
+	{
+	public:
+		~PlyWriter();
+
+		void start();
+		void stop();
+		bool isRunning() const { return m_thread.joinable(); }
+
+		void write(const std::string& path, PlyMesh&& mesh);
+
+		// Writes the file on the calling thread
+		static bool writeFile(const std::string& path, const PlyMesh& mesh);
+
+	private:
+		void run();
+
+		std::thread m_thread;
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		bool m_stop = false;
+		std::deque<std::pair<std::string, PlyMesh>> m_queue;
+	};
+}
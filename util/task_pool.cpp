@@ -0,0 +1,266 @@
+#include "cvpch.h"
+#include "task_pool.h"
+#include "tracer.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace team45
+{
+	namespace
+	{
+		// Tasks per queue, a parallel loop rarely has more chunks than this
+		const size_t QUEUE_CAPACITY = 1024;
+		// Failed searches for a task before a worker goes to sleep
+		const int IDLE_SPINS = 64;
+
+		// Index of the worker running on this thread, -1 outside the pool
+		thread_local int t_worker = -1;
+		// Tasks running on this thread, a task waiting for nested tasks runs them on the same stack
+		thread_local int t_depth = 0;
+
+		void pinThread(std::thread& thread, int core)
+		{
+#ifdef _WIN32
+			SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << core);
+#else
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(core, &set);
+			pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+		}
+	}
+
+	bool TaskPool::Queue::push(const Task& task)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (tail - head == ring.size())
+			return false;
+		ring[tail++ % ring.size()] = task;
+		return true;
+	}
+
+	bool TaskPool::Queue::popBack(Task& task)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (tail == head)
+			return false;
+		task = ring[--tail % ring.size()];
+		return true;
+	}
+
+	bool TaskPool::Queue::popFront(Task& task)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (tail == head)
+			return false;
+		task = ring[head++ % ring.size()];
+		return true;
+	}
+
+	TaskPool::~TaskPool()
+	{
+		shutdown();
+	}
+
+	void TaskPool::init(const Options& options)
+	{
+		shutdown();
+		const int cores = std::max(1, (int)std::thread::hardware_concurrency());
+		const int threads = options.threads > 0 ? options.threads : cores - 1;
+
+		m_callers.queue.ring.resize(QUEUE_CAPACITY);
+		m_stop = false;
+		m_start = std::chrono::steady_clock::now();
+		for (int i = 0; i < threads; i++)
+		{
+			m_workers.push_back(std::make_unique<Worker>());
+			m_workers.back()->queue.ring.resize(QUEUE_CAPACITY);
+		}
+		// Only start once every queue exists, the workers steal from each other
+		for (int i = 0; i < threads; i++)
+		{
+			m_workers[i]->thread = std::thread(&TaskPool::workerLoop, this, i);
+			if (options.pin)
+				pinThread(m_workers[i]->thread, i % cores);
+		}
+		INFO("Task pool with {} workers{}", threads, options.pin ? ", pinned" : "");
+	}
+
+	void TaskPool::shutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_sleep_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (auto& worker : m_workers)
+			worker->thread.join();
+		m_workers.clear();
+	}
+
+	/*
+	 * A worker pushes to its own queue, every other thread to the shared queue
+	 */
+	void TaskPool::submit(const Task& task)
+	{
+		Queue& queue = t_worker >= 0 ? m_workers[t_worker]->queue : m_callers.queue;
+		if (!queue.push(task))
+		{
+			runInline(task.fn, task.context, task.begin, task.end);
+			task.pending->fetch_sub(1, std::memory_order_release);
+			return;
+		}
+		m_queued.fetch_add(1, std::memory_order_release);
+	}
+
+	void TaskPool::wake()
+	{
+		// Taking the mutex orders this with a worker that's about to sleep, so the wake up can't get lost
+		{
+			std::lock_guard<std::mutex> lock(m_sleep_mutex);
+		}
+		m_wake.notify_all();
+	}
+
+	void TaskPool::runInline(RangeFn fn, const void* context, int begin, int end)
+	{
+		execute(t_worker, { fn, context, begin, end, nullptr }, false);
+	}
+
+	/*
+	 * Runs other tasks until the pending ones are done
+	 */
+	void TaskPool::wait(std::atomic<int>& pending)
+	{
+		Task task;
+		bool stolen;
+		while (pending.load(std::memory_order_acquire) > 0)
+		{
+			if (findTask(t_worker, task, stolen))
+				execute(t_worker, task, stolen);
+			else
+				std::this_thread::yield();
+		}
+	}
+
+	bool TaskPool::findTask(int self, Task& task, bool& stolen)
+	{
+		if (m_queued.load(std::memory_order_acquire) == 0)
+			return false;
+
+		stolen = false;
+		if (self >= 0 && m_workers[self]->queue.popBack(task))
+		{
+			m_queued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+		if (m_callers.queue.popFront(task))
+		{
+			m_queued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		// Steal the oldest task, which is usually the largest piece of work left
+		const int workers = (int)m_workers.size();
+		for (int i = 1; i <= workers; i++)
+		{
+			const int victim = (std::max(self, 0) + i) % workers;
+			if (victim != self && m_workers[victim]->queue.popFront(task))
+			{
+				m_queued.fetch_sub(1, std::memory_order_relaxed);
+				stolen = true;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void TaskPool::execute(int self, const Task& task, bool stolen)
+	{
+		auto start = std::chrono::steady_clock::now();
+		t_depth++;
+		task.fn(task.context, task.begin, task.end);
+		t_depth--;
+
+		// Nested tasks are already part of the outermost task's time
+		Worker& counters = self >= 0 ? *m_workers[self] : m_callers;
+		if (t_depth == 0)
+			counters.busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+		counters.tasks.fetch_add(1, std::memory_order_relaxed);
+		if (stolen)
+			counters.steals.fetch_add(1, std::memory_order_relaxed);
+
+		if (task.pending)
+			task.pending->fetch_sub(1, std::memory_order_release);
+	}
+
+	void TaskPool::workerLoop(int index)
+	{
+		t_worker = index;
+		if (tracer::enabled())
+			tracer::setThreadName("Task worker " + std::to_string(index));
+
+		Task task;
+		bool stolen;
+		int idle = 0;
+		while (!m_stop.load(std::memory_order_acquire))
+		{
+			if (findTask(index, task, stolen))
+			{
+				execute(index, task, stolen);
+				idle = 0;
+			}
+			else if (++idle < IDLE_SPINS)
+			{
+				std::this_thread::yield();
+			}
+			else
+			{
+				std::unique_lock<std::mutex> lock(m_sleep_mutex);
+				m_wake.wait(lock, [this] { return m_stop || m_queued.load(std::memory_order_acquire) > 0; });
+				idle = 0;
+			}
+		}
+	}
+
+	std::vector<TaskPool::Utilization> TaskPool::getUtilization() const
+	{
+		std::vector<Utilization> utilization;
+		for (auto& worker : m_workers)
+			utilization.push_back({ worker->busy_ns.load() * 1e-9, worker->tasks.load(), worker->steals.load() });
+		utilization.push_back({ m_callers.busy_ns.load() * 1e-9, m_callers.tasks.load(), m_callers.steals.load() });
+		return utilization;
+	}
+
+	void TaskPool::resetUtilization()
+	{
+		for (auto& worker : m_workers)
+		{
+			worker->busy_ns = 0;
+			worker->tasks = 0;
+			worker->steals = 0;
+		}
+		m_callers.busy_ns = 0;
+		m_callers.tasks = 0;
+		m_callers.steals = 0;
+		m_start = std::chrono::steady_clock::now();
+	}
+
+	void TaskPool::logUtilization() const
+	{
+		const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+		std::vector<Utilization> utilization = getUtilization();
+		INFO("Task pool utilization over {:.1f}s", elapsed);
+		for (size_t i = 0; i < utilization.size(); i++)
+		{
+			const Utilization& u = utilization[i];
+			std::string name = i + 1 < utilization.size() ? "Worker " + std::to_string(i) : "Callers";
+			INFO("  {:<10} {:5.1f}% busy, {} tasks, {} stolen", name, elapsed > 0 ? 100.0 * u.busy_seconds / elapsed : 0.0, u.tasks, u.steals);
+		}
+	}
+}
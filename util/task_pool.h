@@ -0,0 +1,173 @@
+#pragma once
+
+namespace team45
+{
+	/*
+	 * Work-stealing task pool shared by all stages of the pipeline
+	 *
+	 * Every worker owns a queue, it takes its own tasks from the back and steals from the front of the others.
+	 * Threads outside the pool (main, frame worker) submit to a shared queue.
+	 * A thread waiting for its tasks runs queued tasks in the meantime, so parallelFor can be called from inside a task:
+	 * nested loops are spread over the idle workers instead of running serially.
+	 *
+	 * Tasks are plain structs in fixed size ring buffers, so submitting never allocates.
+	 * When a queue is full the task runs on the submitting thread.
+	 */
+	class TaskPool
+	{
+	public:
+		struct Options
+		{
+			int threads = 0;			// Workers besides the calling threads, 0 for hardware threads - 1
+			bool pin = false;			// Pin worker i to core i (modulo the core count)
+		};
+
+		// Busy time and task counts per worker since init or the last reset
+		struct Utilization
+		{
+			double busy_seconds;		// Time in outermost tasks, including waiting for their nested tasks
+			uint64_t tasks;
+			uint64_t steals;			// Tasks taken from another worker's queue
+		};
+
+		static TaskPool& get()
+		{
+			static TaskPool instance;
+			return instance;
+		}
+		~TaskPool();
+		TaskPool(TaskPool const&) = delete;
+		void operator=(TaskPool const&) = delete;
+
+		void init(const Options& options);
+		void shutdown();
+		int workers() const { return (int)m_workers.size(); }
+
+		/*
+		 * Calls body(chunkBegin, chunkEnd) for consecutive chunks of at most grain indices of [begin, end)
+		 * Returns once every chunk has run. The calling thread runs the first chunk itself.
+		 */
+		template <typename Body>
+		void parallelForRange(int begin, int end, int grain, const Body& body)
+		{
+			if (end <= begin)
+				return;
+			grain = std::max(grain, 1);
+			const int chunks = (int)(((int64_t)end - begin + grain - 1) / grain);
+			if (chunks == 1 || m_workers.empty())
+			{
+				body(begin, end);
+				return;
+			}
+
+			std::atomic<int> pending(chunks - 1);
+			RangeFn fn = [](const void* context, int b, int e) { (*static_cast<const Body*>(context))(b, e); };
+			for (int chunk = 1; chunk < chunks; chunk++)
+			{
+				const int b = begin + chunk * grain;
+				submit({ fn, &body, b, std::min(b + grain, end), &pending });
+			}
+			wake();
+
+			runInline(fn, &body, begin, std::min(begin + grain, end));
+			wait(pending);
+		}
+
+		/*
+		 * Calls body(i) for every i in [begin, end), grain indices per task
+		 */
+		template <typename Body>
+		void parallelFor(int begin, int end, int grain, const Body& body)
+		{
+			auto range = [&body](int b, int e)
+			{
+				for (int i = b; i < e; i++)
+					body(i);
+			};
+			parallelForRange(begin, end, grain, range);
+		}
+
+		/*
+		 * Sums body(chunkBegin, chunkEnd) over the chunks in chunk order,
+		 * so the result only depends on the grain, not on the number of workers
+		 */
+		template <typename T, typename Body>
+		T parallelSum(int begin, int end, int grain, T init, const Body& body)
+		{
+			if (end <= begin)
+				return init;
+			grain = std::max(grain, 1);
+			const int chunks = (int)(((int64_t)end - begin + grain - 1) / grain);
+
+			// Small sums stay on the stack
+			std::array<std::byte, 64 * sizeof(T)> buffer;
+			std::pmr::monotonic_buffer_resource memory(buffer.data(), buffer.size());
+			std::pmr::vector<T> partials(chunks, T(), &memory);
+			parallelFor(0, chunks, 1, [&](int chunk)
+			{
+				const int b = begin + chunk * grain;
+				partials[chunk] = body(b, std::min(b + grain, end));
+			});
+
+			T total = init;
+			for (const T& partial : partials)
+				total += partial;
+			return total;
+		}
+
+		std::vector<Utilization> getUtilization() const;
+		void resetUtilization();
+		// Logs the busy percentage of every worker
+		void logUtilization() const;
+
+	private:
+		TaskPool() {};
+
+		using RangeFn = void(*)(const void* context, int begin, int end);
+
+		struct Task
+		{
+			RangeFn fn;
+			const void* context;
+			int begin, end;
+			std::atomic<int>* pending;		// Decremented once the task has run
+		};
+
+		// Mutex guarded ring buffer, owner pops from the back, thieves from the front
+		struct Queue
+		{
+			std::mutex mutex;
+			std::vector<Task> ring;
+			size_t head = 0, tail = 0;		// [head, tail) modulo the ring size are queued
+
+			bool push(const Task& task);
+			bool popBack(Task& task);
+			bool popFront(Task& task);
+		};
+
+		struct Worker
+		{
+			Queue queue;
+			std::thread thread;
+			std::atomic<uint64_t> busy_ns{ 0 };
+			std::atomic<uint64_t> tasks{ 0 };
+			std::atomic<uint64_t> steals{ 0 };
+		};
+
+		void submit(const Task& task);
+		void wake();
+		void runInline(RangeFn fn, const void* context, int begin, int end);
+		void wait(std::atomic<int>& pending);
+		bool findTask(int self, Task& task, bool& stolen);
+		void execute(int self, const Task& task, bool stolen);
+		void workerLoop(int index);
+
+		std::vector<std::unique_ptr<Worker>> m_workers;
+		Worker m_callers;								// Counters of the threads outside the pool, its queue is the shared queue
+		std::atomic<int> m_queued{ 0 };				// Tasks in all queues, the workers sleep while it's 0
+		std::atomic<bool> m_stop{ false };
+		std::mutex m_sleep_mutex;
+		std::condition_variable m_wake;
+		std::chrono::steady_clock::time_point m_start;
+	};
+}
@@ -0,0 +1,142 @@
+#include "cvpch.h"
+#include "tracer.h"
+
+namespace team45
+{
+	namespace
+	{
+		struct TraceEvent
+		{
+			const char* name;
+			int64_t ts;			// Nanoseconds since tracer::init
+			int arg;			// Optional argument (e.g. camera or chunk index), -1 if none
+			char phase;			// 'B' = begin, 'E' = end
+		};
+
+		// Owned by a single thread while recording, only read on shutdown
+		struct ThreadBuffer
+		{
+			int tid;
+			std::string name;
+			std::vector<TraceEvent> events;
+		};
+
+		std::atomic<bool> g_enabled{ false };
+		std::string g_path;
+		std::chrono::steady_clock::time_point g_start;
+
+		// Registry of all thread buffers, the mutex is only taken when a thread records its first event
+		std::mutex g_registry_mutex;
+		std::vector<std::unique_ptr<ThreadBuffer>> g_registry;
+
+		thread_local ThreadBuffer* t_buffer = nullptr;
+
+		ThreadBuffer& threadBuffer()
+		{
+			if (t_buffer == nullptr)
+			{
+				std::lock_guard<std::mutex> lock(g_registry_mutex);
+				g_registry.push_back(std::make_unique<ThreadBuffer>());
+				t_buffer = g_registry.back().get();
+				t_buffer->tid = (int)g_registry.size();
+				t_buffer->name = "Thread " + std::to_string(t_buffer->tid);
+				// Avoid reallocations during the first few thousand frames
+				t_buffer->events.reserve(1 << 16);
+			}
+			return *t_buffer;
+		}
+
+		void record(const char* name, char phase, int arg)
+		{
+			auto now = std::chrono::steady_clock::now();
+			int64_t ts = std::chrono::duration_cast<std::chrono::nanoseconds>(now - g_start).count();
+			threadBuffer().events.push_back({ name, ts, arg, phase });
+		}
+
+		void writeEscaped(std::ostream& os, const std::string& s)
+		{
+			for (char c : s)
+			{
+				if (c == '"' || c == '\\') os << '\\';
+				os << c;
+			}
+		}
+	}
+
+	void tracer::init(const std::string& path)
+	{
+		g_path = path;
+		g_start = std::chrono::steady_clock::now();
+		g_enabled = true;
+		setThreadName("Main");
+		INFO("Recording trace events to {}", path);
+	}
+
+	bool tracer::enabled()
+	{
+		return g_enabled;
+	}
+
+	void tracer::begin(const char* name, int arg)
+	{
+		if (!g_enabled) return;
+		record(name, 'B', arg);
+	}
+
+	void tracer::end(const char* name)
+	{
+		if (!g_enabled) return;
+		record(name, 'E', -1);
+	}
+
+	void tracer::setThreadName(const std::string& name)
+	{
+		threadBuffer().name = name;
+	}
+
+	/**
+	 * Write all recorded events in the Chrome trace_event json format
+	 * https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+	 */
+	void tracer::shutdown()
+	{
+		if (!g_enabled) return;
+		g_enabled = false;
+
+		std::ofstream os(g_path, std::ios::out | std::ios::trunc);
+		if (!os.is_open())
+		{
+			ERROR("Unable to write trace to {}", g_path);
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(g_registry_mutex);
+		size_t count = 0;
+		bool first = true;
+		os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		for (auto& buffer : g_registry)
+		{
+			// Metadata event so the viewer shows readable thread names
+			if (!first) os << ",\n";
+			first = false;
+			os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << buffer->tid << ",\"args\":{\"name\":\"";
+			writeEscaped(os, buffer->name);
+			os << "\"}}";
+
+			for (auto& e : buffer->events)
+			{
+				os << ",\n{\"name\":\"";
+				writeEscaped(os, e.name);
+				os << "\",\"ph\":\"" << e.phase << "\",\"pid\":0,\"tid\":" << buffer->tid
+					<< ",\"ts\":" << e.ts / 1000 << "." << std::setw(3) << std::setfill('0') << e.ts % 1000 << std::setfill(' ');
+				if (e.arg >= 0)
+					os << ",\"args\":{\"arg\":" << e.arg << "}";
+				os << "}";
+			}
+			count += buffer->events.size();
+		}
+		os << "\n]}\n";
+
+		INFO("Wrote {} trace events to {}", count, g_path);
+	}
+}
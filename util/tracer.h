@@ -0,0 +1,47 @@
+#pragma once
+
+namespace team45
+{
+	/*
+	 * Chrome trace-event recorder
+	 * Every thread appends its begin/end events to its own buffer, so recording never takes a lock.
+	 * The buffers are merged once, when the trace is written on shutdown.
+	 * Open the resulting json in https://ui.perfetto.dev or chrome://tracing
+	 */
+	namespace tracer
+	{
+		void init(const std::string& path);
+		void shutdown();
+		bool enabled();
+
+		// Name must be a string literal (or otherwise outlive the tracer)
+		void begin(const char* name, int arg = -1);
+		void end(const char* name);
+
+		// Names the calling thread in the trace viewer
+		void setThreadName(const std::string& name);
+
+		class Scope
+		{
+		public:
+			Scope(const char* name, int arg = -1) : m_name(name) { begin(m_name, arg); }
+			~Scope() { end(m_name); }
+			Scope(Scope const&) = delete;
+			void operator=(Scope const&) = delete;
+		private:
+			const char* m_name;
+		};
+	};
+}
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+// Compiled in with cmake -DENABLE_TRACING=ON
+#ifdef TEAM45_TRACING
+#define TRACE_SCOPE(name)			team45::tracer::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, arg)	team45::tracer::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name, arg)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name, arg)
+#endif
@@ -0,0 +1,345 @@
+#include "cvpch.h"
+#include "track_log.h"
+#include "tracer.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace team45
+{
+	namespace
+	{
+		const char TRACK_MAGIC[8] = { 'T', '4', '5', 'T', 'R', 'A', 'C', 'K' };
+		const uint32_t TRACK_VERSION = 1;
+
+		/*
+		 * Calls add(entry) for every record that starts an index entry: the first record of the log,
+		 * the first record of a frame that comes before the previous one, and the first record every interval frames
+		 */
+		template <typename Add>
+		void indexRecords(const TrackRecord* records, size_t count, uint64_t offset, int interval,
+			int& previousFrame, int& lastIndexed, const Add& add)
+		{
+			for (size_t r = 0; r < count; r++)
+			{
+				const int frame = records[r].frame;
+				if (frame == previousFrame)
+					continue;
+				if (lastIndexed == INT_MIN || frame < previousFrame || frame - lastIndexed >= interval)
+				{
+					add(TrackIndexEntry{ frame, 0, offset + r * sizeof(TrackRecord) });
+					lastIndexed = frame;
+				}
+				previousFrame = frame;
+			}
+		}
+	}
+
+	TrackLogWriter::~TrackLogWriter()
+	{
+		close();
+	}
+
+	bool TrackLogWriter::open(const std::string& path, int persons, int indexInterval)
+	{
+		close();
+		m_index_interval = indexInterval;
+		m_last_indexed = INT_MIN;
+		m_previous_frame = INT_MIN;
+		m_offset = sizeof(TrackLogHeader);
+
+		// Earlier recordings are kept, the new records are appended after them
+		std::error_code error;
+		const uintmax_t size = std::filesystem::file_size(path, error);
+		uint64_t bytes = 0;
+		if (!error && size > 0 && !openExisting(path, persons, bytes))
+			return false;
+
+		m_log = std::fopen(path.c_str(), "ab");
+		if (m_index == nullptr)
+			m_index = std::fopen((path + ".idx").c_str(), "wb");
+		if (m_log == nullptr || m_index == nullptr)
+		{
+			ERROR("Unable to open track log {}", path);
+			close();
+			return false;
+		}
+
+		if (bytes == 0)
+		{
+			TrackLogHeader header = {};
+			std::memcpy(header.magic, TRACK_MAGIC, sizeof(TRACK_MAGIC));
+			header.version = TRACK_VERSION;
+			header.persons = persons;
+			header.record_size = sizeof(TrackRecord);
+			header.index_interval = indexInterval;
+			std::fwrite(&header, sizeof(header), 1, m_log);
+			std::fflush(m_log);
+		}
+
+		m_stop = false;
+		// A few seconds of frames, so append() doesn't have to grow the queue while the disk is slow
+		m_pending.reserve(persons * 256);
+		m_writing.reserve(persons * 256);
+		m_thread = std::thread(&TrackLogWriter::run, this);
+
+		if (bytes > 0)
+			INFO("Appending tracks to {}, after {} earlier records", path, (bytes - sizeof(TrackLogHeader)) / sizeof(TrackRecord));
+		else
+			INFO("Logging tracks to {}", path);
+		return true;
+	}
+
+	/*
+	 * Check that the log at the path can be appended to, drop a partial last record and rebuild the index
+	 * @param bytes Size of the log to append to
+	 */
+	bool TrackLogWriter::openExisting(const std::string& path, int persons, uint64_t& bytes)
+	{
+		std::FILE* log = std::fopen(path.c_str(), "rb");
+		TrackLogHeader header = {};
+		if (log == nullptr || std::fread(&header, sizeof(header), 1, log) != 1
+			|| std::memcmp(header.magic, TRACK_MAGIC, sizeof(TRACK_MAGIC)) != 0
+			|| header.version != TRACK_VERSION
+			|| header.record_size != sizeof(TrackRecord)
+			|| header.persons != (uint32_t)persons)
+		{
+			// Never overwrite a recording we can't append to
+			ERROR("{} is not a track log of {} persons, not logging tracks", path, persons);
+			if (log) std::fclose(log);
+			return false;
+		}
+
+		// A partial last record means the writer was interrupted, cut it off so the new records stay aligned
+		const uint64_t records = (std::filesystem::file_size(path) - sizeof(header)) / sizeof(TrackRecord);
+		bytes = sizeof(header) + records * sizeof(TrackRecord);
+		std::fclose(log);
+		std::error_code error;
+		std::filesystem::resize_file(path, bytes, error);
+
+		// The index might be missing or behind the log, so it's written again from the records
+		m_index_interval = header.index_interval;
+		m_index = std::fopen((path + ".idx").c_str(), "wb");
+		log = std::fopen(path.c_str(), "rb");
+		if (error || m_index == nullptr || log == nullptr)
+		{
+			ERROR("Unable to append to track log {}", path);
+			if (log) std::fclose(log);
+			close();
+			return false;
+		}
+
+		std::fseek(log, sizeof(header), SEEK_SET);
+		std::vector<TrackRecord> chunk(4096);
+		size_t read;
+		while ((read = std::fread(chunk.data(), sizeof(TrackRecord), chunk.size(), log)) > 0)
+		{
+			index(chunk.data(), read);
+			m_offset += read * sizeof(TrackRecord);
+		}
+		std::fclose(log);
+		std::fflush(m_index);
+		return true;
+	}
+
+	/*
+	 * Write the index entries of records that start at m_offset
+	 */
+	void TrackLogWriter::index(const TrackRecord* records, size_t count)
+	{
+		indexRecords(records, count, m_offset, m_index_interval, m_previous_frame, m_last_indexed,
+			[this](const TrackIndexEntry& entry) { std::fwrite(&entry, sizeof(entry), 1, m_index); });
+	}
+
+	void TrackLogWriter::close()
+	{
+		if (m_thread.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_condition.notify_one();
+			m_thread.join();
+		}
+		if (m_log) std::fclose(m_log);
+		if (m_index) std::fclose(m_index);
+		m_log = m_index = nullptr;
+	}
+
+	void TrackLogWriter::append(const TrackRecord* records, size_t count)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending.insert(m_pending.end(), records, records + count);
+		}
+		m_condition.notify_one();
+	}
+
+	void TrackLogWriter::run()
+	{
+		if (tracer::enabled())
+			tracer::setThreadName("Track log");
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_condition.wait(lock, [this] { return m_stop || !m_pending.empty(); });
+				if (m_pending.empty() && m_stop)
+					return;
+				std::swap(m_pending, m_writing);
+			}
+
+			index(m_writing.data(), m_writing.size());
+			std::fwrite(m_writing.data(), sizeof(TrackRecord), m_writing.size(), m_log);
+			std::fflush(m_log);
+			std::fflush(m_index);
+			m_offset += m_writing.size() * sizeof(TrackRecord);
+			m_writing.clear();
+		}
+	}
+
+	TrackLogReader::~TrackLogReader()
+	{
+		close();
+	}
+
+	bool TrackLogReader::open(const std::string& path)
+	{
+		close();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			ERROR("Unable to open track log {}", path);
+			return false;
+		}
+		LARGE_INTEGER size;
+		GetFileSizeEx(file, &size);
+		m_bytes = (size_t)size.QuadPart;
+		HANDLE mapping = m_bytes > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		m_data = mapping ? (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		m_file = file;
+		m_mapping = mapping;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			ERROR("Unable to open track log {}", path);
+			return false;
+		}
+		struct stat st;
+		fstat(fd, &st);
+		m_bytes = (size_t)st.st_size;
+		void* data = m_bytes > 0 ? mmap(nullptr, m_bytes, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+		::close(fd);
+		m_data = data == MAP_FAILED ? nullptr : (const char*)data;
+#endif
+		if (m_data == nullptr || m_bytes < sizeof(TrackLogHeader)
+			|| std::memcmp(getHeader().magic, TRACK_MAGIC, sizeof(TRACK_MAGIC)) != 0
+			|| getHeader().version != TRACK_VERSION
+			|| getHeader().record_size != sizeof(TrackRecord))
+		{
+			ERROR("{} is not a track log", path);
+			close();
+			return false;
+		}
+
+		// A partial last record means the writer was interrupted, leave it out
+		m_records = reinterpret_cast<const TrackRecord*>(m_data + sizeof(TrackLogHeader));
+		m_count = (m_bytes - sizeof(TrackLogHeader)) / sizeof(TrackRecord);
+
+		// The index is small, so it's simply read
+		std::ifstream index(path + ".idx", std::ios::binary);
+		TrackIndexEntry entry;
+		while (index.read(reinterpret_cast<char*>(&entry), sizeof(entry)))
+		{
+			// Entries of a partial last record are left out with it
+			if (entry.offset + sizeof(TrackRecord) <= m_bytes)
+				m_index.push_back(entry);
+		}
+
+		// A missing or stale index is built from the records, the writer rebuilds the file on its next run
+		if (!validIndex())
+		{
+			WARN("Rebuilding the index of track log {}", path);
+			m_index.clear();
+			int previousFrame = INT_MIN, lastIndexed = INT_MIN;
+			indexRecords(m_records, m_count, sizeof(TrackLogHeader), getHeader().index_interval, previousFrame, lastIndexed,
+				[this](const TrackIndexEntry& entry) { m_index.push_back(entry); });
+		}
+		return true;
+	}
+
+	/*
+	 * @return Whether the index entries point at record boundaries with their frame, in order, starting at the first record,
+	 * and the frames don't decrease between two entries
+	 */
+	bool TrackLogReader::validIndex() const
+	{
+		if (m_index.empty())
+			return m_count == 0;
+		if (m_index.front().offset != sizeof(TrackLogHeader))
+			return false;
+
+		for (size_t i = 0; i < m_index.size(); i++)
+		{
+			const TrackIndexEntry& entry = m_index[i];
+			if ((entry.offset - sizeof(TrackLogHeader)) % sizeof(TrackRecord) != 0
+				|| (i > 0 && entry.offset <= m_index[i - 1].offset)
+				|| recordAt(entry.offset)->frame != entry.frame)
+				return false;
+		}
+
+		// An index written by an older version has no entries where the frames jump back
+		size_t next = 1;
+		for (size_t r = 1; r < m_count; r++)
+		{
+			if (next < m_index.size() && &m_records[r] == recordAt(m_index[next].offset))
+				next++;
+			else if (m_records[r].frame < m_records[r - 1].frame)
+				return false;
+		}
+		return true;
+	}
+
+	void TrackLogReader::close()
+	{
+#ifdef _WIN32
+		if (m_data) UnmapViewOfFile(m_data);
+		if (m_mapping) CloseHandle(m_mapping);
+		if (m_file) CloseHandle(m_file);
+		m_file = m_mapping = nullptr;
+#else
+		if (m_data) munmap((void*)m_data, m_bytes);
+#endif
+		m_data = nullptr;
+		m_bytes = 0;
+		m_records = nullptr;
+		m_count = 0;
+		m_index.clear();
+	}
+
+	const TrackRecord* TrackLogReader::findFrame(int frame) const
+	{
+		// The frames increase between two index entries, the latest stretch that covers the frame is searched
+		for (size_t i = m_index.size(); i-- > 0;)
+		{
+			const TrackRecord* first = recordAt(m_index[i].offset);
+			const TrackRecord* last = i + 1 < m_index.size() ? recordAt(m_index[i + 1].offset) : end();
+			if (frame < first->frame || frame > (last - 1)->frame)
+				continue;
+
+			const TrackRecord* record = std::lower_bound(first, last, frame,
+				[](const TrackRecord& r, int f) { return r.frame < f; });
+			return record->frame == frame ? record : end();
+		}
+		return end();
+	}
+}
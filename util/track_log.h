@@ -0,0 +1,119 @@
+#pragma once
+
+namespace team45
+{
+	/*
+	 * Binary track log, one fixed-size record per person per frame
+	 *
+	 * <name>      Header, followed by the records in the order they were appended
+	 * <name>.idx  Index entry (frame, byte offset) every `index_interval` frames, and wherever the frames
+	 *             stop increasing (playback jumped back, or a later run appended its recording).
+	 *             Between two entries the frames increase, so a frame is found with a binary search.
+	 *
+	 * The records are appended and flushed every frame by a background thread,
+	 * so a recording survives the process dying (at most a partial last record is lost).
+	 * Opening an existing log appends to it, the index is rebuilt from the records.
+	 */
+	struct TrackLogHeader
+	{
+		char magic[8];				// "T45TRACK"
+		uint32_t version;
+		uint32_t persons;
+		uint32_t record_size;		// sizeof(TrackRecord)
+		uint32_t index_interval;	// Frames between index entries
+		uint64_t reserved;
+	};
+	static_assert(sizeof(TrackLogHeader) == 32, "Track log header must be 32 bytes");
+
+	struct TrackRecord
+	{
+		int32_t frame;
+		int16_t person;
+		uint16_t flags;				// TRACK_COASTED if the measurement was gated and the position is a prediction
+		float x, y;					// Filtered floor position (mm)
+		float vx, vy;				// Velocity (mm per frame)
+	};
+	static_assert(sizeof(TrackRecord) == 24, "Track record must be 24 bytes");
+
+	struct TrackIndexEntry
+	{
+		int32_t frame;
+		uint32_t reserved;
+		uint64_t offset;			// Byte offset of the frame's first record in the log
+	};
+
+	static const uint16_t TRACK_COASTED = 1;
+
+	class TrackLogWriter
+	{
+	public:
+		~TrackLogWriter();
+
+		bool open(const std::string& path, int persons, int indexInterval);
+		void close();
+		bool isOpen() const { return m_thread.joinable(); }
+
+		/*
+		 * Queue the records of one frame, never blocks on the disk
+		 */
+		void append(const TrackRecord* records, size_t count);
+
+	private:
+		bool openExisting(const std::string& path, int persons, uint64_t& bytes);
+		void index(const TrackRecord* records, size_t count);
+		void run();
+
+		std::FILE* m_log = nullptr;
+		std::FILE* m_index = nullptr;
+		int m_index_interval = 0;
+		int m_last_indexed = INT_MIN;
+		int m_previous_frame = INT_MIN;
+		uint64_t m_offset = 0;
+
+		std::thread m_thread;
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		bool m_stop = false;
+		std::vector<TrackRecord> m_pending;		// Filled by append()
+		std::vector<TrackRecord> m_writing;		// Owned by the writer thread, swapped with m_pending
+	};
+
+	/*
+	 * Memory-mapped, read-only view of a track log
+	 */
+	class TrackLogReader
+	{
+	public:
+		~TrackLogReader();
+
+		bool open(const std::string& path);
+		void close();
+
+		const TrackLogHeader& getHeader() const { return *reinterpret_cast<const TrackLogHeader*>(m_data); }
+		const TrackRecord* begin() const { return m_records; }
+		const TrackRecord* end() const { return m_records + m_count; }
+		size_t size() const { return m_count; }
+
+		/*
+		 * @return The first record of the frame, from the most recent stretch of the log that holds it. end() if none
+		 */
+		const TrackRecord* findFrame(int frame) const;
+
+	private:
+		const TrackRecord* recordAt(uint64_t offset) const
+		{
+			return reinterpret_cast<const TrackRecord*>(m_data + offset);
+		}
+		bool validIndex() const;
+
+		const char* m_data = nullptr;
+		size_t m_bytes = 0;
+		const TrackRecord* m_records = nullptr;
+		size_t m_count = 0;
+		std::vector<TrackIndexEntry> m_index;
+#ifdef _WIN32
+		void* m_file = nullptr;
+		void* m_mapping = nullptr;
+#endif
+	};
+}
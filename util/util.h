@@ -39,15 +39,55 @@ namespace util
 	static const std::string SETTINGS = "settings.xml";
 	static const std::string BINS = "bins.xml";
 	static const std::string TRACKING2D = "tracking2d.xml";
+	static const std::string TRACE_FILE = "trace.json";
+	static const std::string TRACK_LOG = "tracks.bin";
+	static const int TRACK_LOG_INDEX_INTERVAL = 100;		// Frames between entries of the track log index
+	static const int TRACK_BUFFER_CAPACITY = 1024;		// Initial vertices per person on the GPU, doubles when full
+	static const int VOXEL_UPLOAD_GAP = 64;				// Dirty voxel instances closer than this are uploaded in one call
+	static const std::string MESH_FILE = "mesh";			// Meshes are written to <MESH_FILE>_<frame>[_<person>].ply
+	static const bool MESH_PER_PERSON = true;				// One mesh per person instead of one for all voxels
+	static const int K_MESH_SLAB_DEPTH = 4;				// Cell layers per parallel task of the mesh extraction
+	static const int TASK_POOL_THREADS = 0;				// Task pool workers, 0 for one less than the hardware threads
+	static const bool TASK_POOL_PIN = false;				// Pin every task pool worker to its own core
 	
 	static const int CALIB_MAX_NR_FRAMES = 40;
 	static const int CALIB_LOCAL_FRAMES = 3;
+	static const int CALIB_DECODE_WINDOW = 128;			// Frames the calibration video is decoded ahead of the detections
+	static const int CALIB_PYRAMID_WIDTH = 0;			// Search the board on a downscaled frame at least this wide, 0 for full resolution
 
 	static const float SCENE_CAM_SPEED = .01f;
 
 	static const int K_NR_OF_PERSONS = 4;
 	static const int K_NR_OF_ATTEMPTS = 10;
-	static const float K_OUTLIER_MAX_DIST = 50.f;
+	static const int K_WARM_MAX_ITERATIONS = 10;		// Iteration cap of warm-started k-means
+	static const int K_RESTART_MAX_ITERATIONS = 100;	// Iteration cap of every k-means++ attempt, as in cv::kmeans
+	static const double K_WARM_EPSILON = 1.0;			// Center movement (mm) at which warm-started k-means stops
+	static const double K_WARM_COMPACTNESS_FACTOR = 1.5;	// Restart k-means once compactness exceeds the reference by this factor
+	static const int K_GRID_MIN_COLUMN = 4;				// Visible voxels needed for a floor column to count as occupied
+	static const int K_GRID_MIN_CELLS = 4;				// Occupied columns needed for a floor grid component to count as a person
+
+	static const float K_TRACK_PROCESS_NOISE = 25.f;		// Variance (mm^2) added to the track state every frame
+	static const float K_TRACK_MEASUREMENT_NOISE = 400.f;	// Variance (mm^2) of a cluster center
+	static const float K_TRACK_INITIAL_VELOCITY_VAR = 2500.f;	// Variance ((mm/frame)^2) of the velocity of a new track
+	static const double K_TRACK_GATE = 9.21;			// Squared Mahalanobis distance beyond which a center is ignored (chi-square, 2 dof, 99%)
+	static const int K_TRACK_MAX_MISSES = 5;			// Ignored centers in a row after which a track restarts
+
+	static const int K_OCCLUSION_RADIUS = 2;			// Half size of the pixel window checked for closer voxels
+	static const int K_COLOR_CHANGE_THRESHOLD = 8;		// Channel difference at which a voxel's pixel counts as changed
+	static const int K_COLOR_MODEL_CHUNKS = 16;			// Voxel chunks with their own partial histograms when building color models
+	static const int K_CARVE_TILE_ROWS = 16;			// Image rows per parallel task when carving the voxels of a camera
+	static const size_t K_FRAME_ARENA_BYTES = 16 * 1024;	// Initial buffer of the per-frame arena, only exceeded for very many cameras
+	static const int K_ALLOC_WARMUP_FRAMES = 10;		// Frames to grow the reusable buffers before allocations are reported
+
+	static const bool COLOR_MODEL_BOOTSTRAP = true;		// Build missing color models automatically, false to draw them and sync the person ids by hand
+	static const int K_BOOTSTRAP_CANDIDATES = 24;		// Evenly spaced frames scored on person separation when creating color models
+	static const int K_BOOTSTRAP_FRAMES = 5;			// Best separated frames the color models are built from
+
+	static const int K_NR_OF_BINS = 9;					// Dominant colors per color model
+	static const int K_BINS_FRAMES = 8;					// Evenly spaced frames per camera the bins are sampled from
+	static const int K_BINS_SAMPLES = 1 << 16;			// Foreground pixels kept for clustering the bins, over all cameras
+	static const int K_BINS_BATCH_SIZE = 1024;			// Pixels per mini-batch k-means iteration
+	static const int K_BINS_ITERATIONS = 300;			// Mini-batch k-means iterations
 
 	/**
 	 * Linux/Windows friendly way to check if a file exists
@@ -120,26 +160,6 @@ namespace util
 		is.close();
 	}
 
-	// https://www.cplusplus.com/reference/algorithm/next_permutation/
-	static std::vector<std::vector<int>> permutations(int n)
-	{
-		// Permutations so far
-		std::vector<std::vector<int>> pmts;
-
-		// Initial combinations
-		std::vector<int> ks;
-		for (int i = 0; i < n; i++)
-			ks.push_back(i);
-
-		pmts.push_back(ks);
-		while (std::next_permutation(ks.begin(), ks.end()))
-		{
-			pmts.push_back(ks);
-		}
-
-		return pmts;
-	}
-
 	namespace random
 	{
 		// Deterministic rng
@@ -12,6 +12,8 @@ namespace team45
 
 	VertexBuffer::~VertexBuffer()
 	{
+		glDeleteBuffers(1, &m_VBO);
+		glDeleteBuffers(1, &m_EBO);
 		glDeleteVertexArrays(1, &m_VAO);
 	}
 